@@ -0,0 +1,331 @@
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "player.h"
+
+/*
+ * Plays a file through null or file sinks, in real time like on a device,
+ * and reports how well the player kept up.
+ */
+
+// share of pictures reported as in sync
+#define SYNC_WITHIN_MS 20
+// default of -M
+#define BENCH_CACHE_BYTES (256 * 1024 * 1024)
+
+typedef struct BenchResult {
+	const char *url;
+	const char *name;              // of the media in the json line
+	double wall;                   // s, open to the end of playback
+	double open;                   // s, start to the decoders open
+	double first_frame;            // s, start to the first picture shown
+	double user, sys;              // s of cpu
+	long peak_rss;                 // KB
+	double decode_fps;             // frames per second of decoder time
+	double sync_mean;              // ms, master clock minus shown picture
+	double sync_within;            // % of pictures within SYNC_WITHIN_MS
+	Metrics metrics;
+} BenchResult;
+
+static void usage() {
+	fprintf(stderr,
+			"usage: avsync-bench [options] file\n"
+			"  -a null|file   audio sink (null)\n"
+			"  -v null|file   video sink (null)\n"
+			"  -o prefix      file sink output, <prefix>.pcm and <prefix>.yuv\n"
+			"  -r rate        playback rate, %.1f to %.1f (1.0)\n"
+			"  -s audio|video|ext  master clock (audio)\n"
+			"  -t seconds     stop after this long\n"
+			"  -p bytes       probe size (avformat default)\n"
+			"  -d ms          probe duration (avformat default)\n"
+			"  -f             no probing when the headers describe the streams\n"
+			"  -b ms          audio buffered before playback starts (%d)\n"
+			"  -w ms          hold playback below this much queued (%d)\n"
+			"  -W ms          until this much is queued again (%d)\n"
+			"  -i bytes       read ahead of local files (%d)\n"
+			"  -I seconds     read ahead this much media instead, up to -i\n"
+			"  -C dir         disk cache of http media and HLS segments\n"
+			"  -M bytes       size of the cache (%d)\n"
+			"  -j file        append the results as a json line\n"
+			"  -n name        media name in it, the file name by default\n"
+			"  -T file        write chrome trace events, needs AVSYNC_TRACE\n"
+			"  -q             only log warnings and errors\n",
+			PLAYBACK_RATE_MIN, PLAYBACK_RATE_MAX, PREROLL_AUDIO_MS,
+			BUFFER_LOW_MS, BUFFER_HIGH_MS, IO_READ_AHEAD_BYTES,
+			BENCH_CACHE_BYTES);
+}
+
+static double timeval_seconds(struct timeval *tv) {
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static void collect_result(BenchResult *r) {
+	Histogram *diff = &r->metrics.histograms[HISTOGRAM_AV_DIFF];
+	Histogram *decode = &r->metrics.histograms[HISTOGRAM_DECODE_TIME];
+	int64_t frames = r->metrics.counters[METRIC_VIDEO_FRAMES];
+	int64_t samples = 0, within = 0;
+	struct rusage ru;
+	int i;
+
+	getrusage(RUSAGE_SELF, &ru);
+	r->user = timeval_seconds(&ru.ru_utime);
+	r->sys = timeval_seconds(&ru.ru_stime);
+	r->peak_rss = ru.ru_maxrss;
+
+	r->open = r->metrics.counters[METRIC_OPEN_TIME] / 1000000.0;
+	r->first_frame = r->metrics.counters[METRIC_FIRST_FRAME_TIME] / 1000000.0;
+
+	r->decode_fps = (decode->sum > 0) ? frames * 1000000.0 / decode->sum : 0;
+
+	for (i = 0; i < diff->nb_buckets; i++) {
+		samples += diff->counts[i];
+		// buckets bounded on both sides inside the window
+		if ((i > 0) && (i < diff->nb_buckets - 1)
+				&& (diff->bounds[i - 1] >= -SYNC_WITHIN_MS)
+				&& (diff->bounds[i] <= SYNC_WITHIN_MS)) {
+			within += diff->counts[i];
+		}
+	}
+	r->sync_mean = samples ? (double) diff->sum / samples : 0;
+	r->sync_within = samples ? within * 100.0 / samples : 0;
+}
+
+static void print_report(BenchResult *r) {
+	int64_t *counters = r->metrics.counters;
+
+	printf("avsync-bench: %s\n", r->url);
+	printf("  wall time       %.2f s\n", r->wall);
+	printf("  open            %.1f ms\n", r->open * 1000);
+	printf("  first frame     %.1f ms\n", r->first_frame * 1000);
+	printf("  cpu time        %.2f s user, %.2f s sys (%.1f%% of one core)\n",
+			r->user, r->sys,
+			(r->wall > 0) ? (r->user + r->sys) * 100 / r->wall : 0);
+	printf("  peak rss        %ld KB\n", r->peak_rss);
+	printf("  video frames    decoded %" PRId64 ", displayed %" PRId64
+			", skipped %" PRId64 ", repeated %" PRId64
+			", dropped late %" PRId64 ", early %" PRId64 "\n",
+			counters[METRIC_VIDEO_FRAMES], counters[METRIC_FRAMES_DISPLAYED],
+			counters[METRIC_FRAMES_SKIPPED], counters[METRIC_FRAMES_REPEATED],
+			counters[METRIC_FRAMES_DROPPED_LATE],
+			counters[METRIC_FRAMES_DROPPED_EARLY]);
+	printf("  decode          %.1f fps\n", r->decode_fps);
+	printf("  sync error      mean %.1f ms, %.1f%% within +-%d ms\n",
+			r->sync_mean, r->sync_within, SYNC_WITHIN_MS);
+	printf("  audio underruns %" PRId64 "\n", counters[METRIC_AUDIO_UNDERRUNS]);
+	printf("  rebuffering     %" PRId64 " times, %.1f ms\n",
+			counters[METRIC_REBUFFERS],
+			counters[METRIC_REBUFFER_TIME] / 1000.0);
+	printf("  http urls       %" PRId64 " from the cache, %" PRId64
+			" from the network\n", counters[METRIC_CACHE_HITS],
+			counters[METRIC_CACHE_MISSES]);
+}
+
+// one flat object per line, avsync-compare reads the numbers by key
+static int write_result(BenchResult *r, const char *path) {
+	int64_t *counters = r->metrics.counters;
+	const char *media = r->name ? r->name : strrchr(r->url, '/');
+	FILE *file = fopen(path, "a");
+
+	if (NULL == file) {
+		fprintf(stderr, "avsync-bench: can not open %s\n", path);
+		return -1;
+	}
+
+	fprintf(file, "{\"media\":\"%s\",\"wall_s\":%.3f,\"open_ms\":%.1f,"
+			"\"first_frame_ms\":%.1f,\"cpu_s\":%.3f,\"peak_rss_kb\":%ld,"
+			"\"decode_fps\":%.1f,\"sync_mean_ms\":%.1f,\"sync_within_pct\":%.1f,"
+			"\"frames_displayed\":%" PRId64 ",\"frames_dropped_late\":%" PRId64
+			",\"audio_underruns\":%" PRId64 ",\"rebuffers\":%" PRId64
+			",\"rebuffer_ms\":%.1f}\n",
+			media ? media + (media != r->name) : r->url, r->wall,
+			r->open * 1000, r->first_frame * 1000, r->user + r->sys,
+			r->peak_rss, r->decode_fps, r->sync_mean, r->sync_within,
+			counters[METRIC_FRAMES_DISPLAYED],
+			counters[METRIC_FRAMES_DROPPED_LATE],
+			counters[METRIC_AUDIO_UNDERRUNS], counters[METRIC_REBUFFERS],
+			counters[METRIC_REBUFFER_TIME] / 1000.0);
+	fclose(file);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	AudioSink *audio_sink = &null_audio_sink;
+	VideoSink *video_sink = &null_video_sink;
+	const char *trace_path = NULL, *result_path = NULL, *cache = NULL;
+	const char *name = NULL;
+	int64_t cache_bytes = BENCH_CACHE_BYTES;
+	double rate = 1.0, timeout = 0, read_ahead_seconds = 0;
+	int64_t probesize = 0, analyzeduration = 0;
+	int64_t read_ahead = IO_READ_AHEAD_BYTES;
+	int sync_type = AV_SYNC_AUDIO_MASTER, fast_start = 0;
+	int preroll = PREROLL_AUDIO_MS;
+	int buffer_low = BUFFER_LOW_MS, buffer_high = BUFFER_HIGH_MS;
+	int64_t start, now;
+	Player *player;
+	BenchResult result;
+	char *json;
+	FILE *file;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "a:v:o:r:s:t:p:d:fb:w:W:i:I:C:M:j:n:T:q"))
+			!= -1) {
+		switch (c) {
+		case 'a':
+			if (!strcmp(optarg, "file")) {
+				audio_sink = &file_audio_sink;
+			} else if (strcmp(optarg, "null")) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'v':
+			if (!strcmp(optarg, "file")) {
+				video_sink = &file_video_sink;
+			} else if (strcmp(optarg, "null")) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'o':
+			set_file_sink_prefix(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 's':
+			if (!strcmp(optarg, "audio")) {
+				sync_type = AV_SYNC_AUDIO_MASTER;
+			} else if (!strcmp(optarg, "video")) {
+				sync_type = AV_SYNC_VIDEO_MASTER;
+			} else if (!strcmp(optarg, "ext")) {
+				sync_type = AV_SYNC_EXTERNAL_MASTER;
+			} else {
+				usage();
+				return 1;
+			}
+			break;
+		case 't':
+			timeout = atof(optarg);
+			break;
+		case 'p':
+			probesize = atoll(optarg);
+			break;
+		case 'd':
+			analyzeduration = atoll(optarg) * 1000;
+			break;
+		case 'f':
+			fast_start = 1;
+			break;
+		case 'b':
+			preroll = atoi(optarg);
+			break;
+		case 'w':
+			buffer_low = atoi(optarg);
+			break;
+		case 'W':
+			buffer_high = atoi(optarg);
+			break;
+		case 'i':
+			read_ahead = atoll(optarg);
+			break;
+		case 'I':
+			read_ahead_seconds = atof(optarg);
+			break;
+		case 'C':
+			cache = optarg;
+			break;
+		case 'M':
+			cache_bytes = atoll(optarg);
+			break;
+		case 'j':
+			result_path = optarg;
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'q':
+			for (i = 0; i < LOG_CATEGORY_NB; i++) {
+				setLogLevel(i, ANDROID_LOG_WARN);
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		return 1;
+	}
+
+	memset(&result, 0, sizeof(result));
+	result.url = argv[optind];
+	result.name = name;
+
+	if (cache && (setStreamCache(cache, cache_bytes) < 0)) {
+		return 1;
+	}
+
+	player = createPlayer(audio_sink, video_sink);
+	if (NULL == player) {
+		return 1;
+	}
+	setSyncType(player, sync_type);
+	if ((openPath(player, argv[optind]) < 0)
+			|| (setPlaybackRate(player, rate) < 0)
+			|| (setProbeOptions(player, probesize, analyzeduration, fast_start)
+					< 0) || (setPrerollDuration(player, preroll) < 0)
+			|| (setBufferingWatermarks(player, buffer_low, buffer_high) < 0)
+			|| (setReadAhead(player, read_ahead, read_ahead_seconds) < 0)) {
+		return 1;
+	}
+
+	start = av_gettime_relative();
+	if (startPlayer(player) < 0) {
+		return 1;
+	}
+
+	while (!player->open_failed && !playback_finished(player)) {
+		now = av_gettime_relative();
+		if ((timeout > 0) && (now - start >= timeout * 1000000)) {
+			break;
+		}
+
+		av_usleep(10000);
+	}
+	result.wall = (av_gettime_relative() - start) / 1000000.0;
+
+	if (player->open_failed) {
+		fprintf(stderr, "avsync-bench: can not play %s\n", argv[optind]);
+		return 1;
+	}
+
+	// no task runs once it returns, destroyPlayer() joins the rest
+	stopPlayer(player);
+
+	getMetrics(player, &result.metrics);
+	destroyPlayer(player);
+	collect_result(&result);
+	print_report(&result);
+	if (result_path && (write_result(&result, result_path) < 0)) {
+		return 1;
+	}
+
+	if (trace_path) {
+		json = trace_dump();
+		if (NULL == json) {
+			fprintf(stderr, "avsync-bench: built without AVSYNC_TRACE\n");
+		} else if ((file = fopen(trace_path, "w")) != NULL) {
+			fputs(json, file);
+			fclose(file);
+		}
+		av_free(json);
+	}
+
+	return 0;
+}
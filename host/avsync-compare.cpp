@@ -0,0 +1,177 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compares two result files of avsync-bench -j, media by media, and fails
+ * when a metric got worse than the threshold.
+ */
+
+#define COMPARE_MAX_RESULTS 256
+#define COMPARE_LINE_SIZE 2048
+
+typedef struct CompareMetric {
+	const char *key;
+	int higher_is_better;
+	double floor;                  // changes below this are noise, in units
+} CompareMetric;
+
+static const CompareMetric metrics[] = {
+	{ "decode_fps", 1, 1.0 },
+	{ "open_ms", 0, 5.0 },
+	{ "first_frame_ms", 0, 5.0 },
+	{ "cpu_s", 0, 0.05 },
+	{ "peak_rss_kb", 0, 1024 },
+	{ "sync_within_pct", 1, 1.0 },
+	{ "frames_dropped_late", 0, 2 },
+	{ "audio_underruns", 0, 1 },
+	{ "rebuffers", 0, 1 },
+	{ "rebuffer_ms", 0, 50 },
+};
+
+typedef struct ResultSet {
+	char *lines[COMPARE_MAX_RESULTS];
+	int nb_lines;
+} ResultSet;
+
+static int load_results(const char *path, ResultSet *set) {
+	char line[COMPARE_LINE_SIZE];
+	FILE *file = fopen(path, "r");
+
+	if (NULL == file) {
+		fprintf(stderr, "avsync-compare: can not open %s\n", path);
+		return -1;
+	}
+
+	set->nb_lines = 0;
+	while (fgets(line, sizeof(line), file)
+			&& (set->nb_lines < COMPARE_MAX_RESULTS)) {
+		if (strstr(line, "\"media\":")) {
+			set->lines[set->nb_lines++] = strdup(line);
+		}
+	}
+	fclose(file);
+
+	return 0;
+}
+
+// the string value of "media", copied to media
+static int get_media(const char *line, char *media, int size) {
+	const char *p = strstr(line, "\"media\":\"");
+	int i;
+
+	if (NULL == p) {
+		return -1;
+	}
+
+	p += strlen("\"media\":\"");
+	for (i = 0; (i < size - 1) && p[i] && (p[i] != '"'); i++) {
+		media[i] = p[i];
+	}
+	media[i] = 0;
+
+	return 0;
+}
+
+static int get_number(const char *line, const char *key, double *value) {
+	char pattern[64];
+	const char *p;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	p = strstr(line, pattern);
+	if (NULL == p) {
+		return -1;
+	}
+
+	*value = strtod(p + strlen(pattern), NULL);
+	return 0;
+}
+
+static const char *find_media(ResultSet *set, const char *media) {
+	char name[256];
+	int i;
+
+	for (i = 0; i < set->nb_lines; i++) {
+		if (!get_media(set->lines[i], name, sizeof(name))
+				&& !strcmp(name, media)) {
+			return set->lines[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void usage() {
+	fprintf(stderr,
+			"usage: avsync-compare [-t percent] baseline.jsonl results.jsonl\n"
+			"  -t percent     allowed change for the worse (10)\n");
+}
+
+int main(int argc, char **argv) {
+	ResultSet baseline, results;
+	const CompareMetric *m;
+	const char *base_line;
+	double threshold = 10, base, value, change, worse;
+	char media[256];
+	int c, i, j, regressions = 0;
+
+	while ((c = getopt(argc, argv, "t:")) != -1) {
+		switch (c) {
+		case 't':
+			threshold = atof(optarg);
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+
+	if (optind != argc - 2) {
+		usage();
+		return 2;
+	}
+
+	if ((load_results(argv[optind], &baseline) < 0)
+			|| (load_results(argv[optind + 1], &results) < 0)) {
+		return 2;
+	}
+
+	for (i = 0; i < results.nb_lines; i++) {
+		if (get_media(results.lines[i], media, sizeof(media)) < 0) {
+			continue;
+		}
+
+		base_line = find_media(&baseline, media);
+		if (NULL == base_line) {
+			printf("%s: not in the baseline\n", media);
+			continue;
+		}
+
+		printf("%s:\n", media);
+		for (j = 0; j < (int) (sizeof(metrics) / sizeof(metrics[0])); j++) {
+			m = &metrics[j];
+			if ((get_number(base_line, m->key, &base) < 0)
+					|| (get_number(results.lines[i], m->key, &value) < 0)) {
+				continue;
+			}
+
+			change = (base != 0) ? (value - base) * 100 / base : 0;
+			worse = m->higher_is_better ? base - value : value - base;
+
+			if ((worse > m->floor)
+					&& ((base == 0) || (worse * 100 / base > threshold))) {
+				printf("  %-20s %12.2f -> %12.2f  %+7.1f%%  REGRESSION\n",
+						m->key, base, value, change);
+				regressions++;
+			} else {
+				printf("  %-20s %12.2f -> %12.2f  %+7.1f%%\n", m->key, base,
+						value, change);
+			}
+		}
+	}
+
+	printf("%d regression%s\n", regressions, (regressions == 1) ? "" : "s");
+
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,362 @@
+#include <getopt.h>
+#include <unistd.h>
+
+#include "player.h"
+
+/*
+ * Writes the benchmark corpus: a moving test pattern and a sine tone, encoded
+ * with the encoders of the linked FFmpeg. Entries whose encoder or muxer is
+ * missing are skipped, so the corpus depends on how FFmpeg was configured.
+ */
+
+#define CORPUS_FRAME_RATE 25
+#define CORPUS_SAMPLE_RATE 48000
+#define CORPUS_TONE_HZ 440.0
+
+typedef struct CorpusEntry {
+	const char *name;              // file name, the extension picks the muxer
+	enum AVCodecID video_codec;
+	int width, height;
+	int max_b_frames;
+	enum AVCodecID audio_codec;
+	int large;                     // only written with -a
+} CorpusEntry;
+
+static const CorpusEntry corpus[] = {
+	{ "h264_480p_aac.mp4", AV_CODEC_ID_H264, 854, 480, 2, AV_CODEC_ID_AAC, 0 },
+	{ "h264_480p_nob_aac.ts", AV_CODEC_ID_H264, 854, 480, 0, AV_CODEC_ID_AAC, 0 },
+	{ "h264_720p_mp3.mkv", AV_CODEC_ID_H264, 1280, 720, 2, AV_CODEC_ID_MP3, 0 },
+	{ "h264_1080p_ac3.ts", AV_CODEC_ID_H264, 1920, 1080, 3, AV_CODEC_ID_AC3, 0 },
+	{ "h264_2160p_aac.mp4", AV_CODEC_ID_H264, 3840, 2160, 2, AV_CODEC_ID_AAC, 1 },
+	{ "hevc_720p_nob_aac.mp4", AV_CODEC_ID_HEVC, 1280, 720, 0, AV_CODEC_ID_AAC, 0 },
+	{ "hevc_1080p_ac3.mkv", AV_CODEC_ID_HEVC, 1920, 1080, 2, AV_CODEC_ID_AC3, 0 },
+	{ "hevc_2160p_aac.ts", AV_CODEC_ID_HEVC, 3840, 2160, 2, AV_CODEC_ID_AAC, 1 },
+	{ "mpeg2_480p_mp3.ts", AV_CODEC_ID_MPEG2VIDEO, 720, 480, 2, AV_CODEC_ID_MP3, 0 },
+	{ "mpeg2_1080p_nob_ac3.mkv", AV_CODEC_ID_MPEG2VIDEO, 1920, 1080, 0, AV_CODEC_ID_AC3, 0 },
+	{ "mpeg2_2160p_aac.ts", AV_CODEC_ID_MPEG2VIDEO, 3840, 2160, 2, AV_CODEC_ID_AAC, 1 },
+};
+
+typedef struct OutputStream {
+	AVStream *st;
+	AVCodecContext *enc;
+	AVFrame *frame;
+	int64_t next_pts;              // in the encoder time base
+	int finished;
+} OutputStream;
+
+static int open_stream(AVFormatContext *oc, OutputStream *ost,
+		enum AVCodecID codec_id, const CorpusEntry *entry) {
+	const AVCodec *codec = avcodec_find_encoder(codec_id);
+	AVCodecContext *c;
+	int i, ret;
+
+	if (NULL == codec) {
+		fprintf(stderr, "avsync-corpus: no %s encoder\n",
+				avcodec_get_name(codec_id));
+		return AVERROR_ENCODER_NOT_FOUND;
+	}
+
+	ost->st = avformat_new_stream(oc, NULL);
+	c = avcodec_alloc_context3(codec);
+	if ((NULL == ost->st) || (NULL == c)) {
+		return AVERROR(ENOMEM);
+	}
+	ost->enc = c;
+
+	if (codec->type == AVMEDIA_TYPE_VIDEO) {
+		c->width = entry->width;
+		c->height = entry->height;
+		c->time_base = (AVRational ) { 1, CORPUS_FRAME_RATE };
+		c->framerate = (AVRational ) { CORPUS_FRAME_RATE, 1 };
+		c->gop_size = CORPUS_FRAME_RATE * 2;
+		c->max_b_frames = entry->max_b_frames;
+		c->pix_fmt = AV_PIX_FMT_YUV420P;
+		c->bit_rate = (int64_t) c->width * c->height * 4;
+		// the faster presets of x264/x265 drop b-frames
+		av_opt_set(c->priv_data, "preset", "veryfast", 0);
+	} else {
+		c->sample_fmt = codec->sample_fmts ?
+				codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+		c->sample_rate = CORPUS_SAMPLE_RATE;
+		if (codec->supported_samplerates) {
+			c->sample_rate = codec->supported_samplerates[0];
+			for (i = 0; codec->supported_samplerates[i]; i++) {
+				if (codec->supported_samplerates[i] == CORPUS_SAMPLE_RATE) {
+					c->sample_rate = CORPUS_SAMPLE_RATE;
+				}
+			}
+		}
+		c->channel_layout = AV_CH_LAYOUT_STEREO;
+		c->channels = 2;
+		c->bit_rate = 192000;
+		c->time_base = (AVRational ) { 1, c->sample_rate };
+	}
+
+	if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
+		c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+
+	if ((ret = avcodec_open2(c, codec, NULL)) < 0) {
+		fprintf(stderr, "avsync-corpus: can not open the %s encoder\n",
+				codec->name);
+		return ret;
+	}
+
+	if ((ret = avcodec_parameters_from_context(ost->st->codecpar, c)) < 0) {
+		return ret;
+	}
+	ost->st->time_base = c->time_base;
+
+	ost->frame = av_frame_alloc();
+	if (NULL == ost->frame) {
+		return AVERROR(ENOMEM);
+	}
+
+	if (codec->type == AVMEDIA_TYPE_VIDEO) {
+		ost->frame->format = c->pix_fmt;
+		ost->frame->width = c->width;
+		ost->frame->height = c->height;
+	} else {
+		ost->frame->format = c->sample_fmt;
+		ost->frame->channel_layout = c->channel_layout;
+		ost->frame->sample_rate = c->sample_rate;
+		ost->frame->nb_samples =
+				(c->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) ?
+						1024 : c->frame_size;
+	}
+
+	return av_frame_get_buffer(ost->frame, 32);
+}
+
+static void close_stream(OutputStream *ost) {
+	avcodec_free_context(&ost->enc);
+	av_frame_free(&ost->frame);
+}
+
+// diagonal gradient moving right, a bar moving down, chroma cycling
+static void fill_picture(AVFrame *frame, int64_t n) {
+	int x, y, bar = (int) (n * 8 % frame->height);
+	uint8_t *row;
+
+	for (y = 0; y < frame->height; y++) {
+		row = frame->data[0] + y * frame->linesize[0];
+		for (x = 0; x < frame->width; x++) {
+			row[x] = (y >= bar) && (y < bar + 16) ? 235 : (x + y + n * 4) & 0xff;
+		}
+	}
+
+	for (y = 0; y < frame->height / 2; y++) {
+		memset(frame->data[1] + y * frame->linesize[1],
+				(int) (128 + 64 * sin(n * 0.05)), frame->width / 2);
+		memset(frame->data[2] + y * frame->linesize[2],
+				(int) (128 + 64 * cos(n * 0.05)), frame->width / 2);
+	}
+}
+
+static void fill_tone(AVFrame *frame, int64_t first) {
+	int i, ch, channels = av_frame_get_channels(frame);
+	double v;
+
+	for (i = 0; i < frame->nb_samples; i++) {
+		v = 0.3 * sin(2 * M_PI * CORPUS_TONE_HZ * (first + i)
+				/ frame->sample_rate);
+		for (ch = 0; ch < channels; ch++) {
+			switch (frame->format) {
+			case AV_SAMPLE_FMT_FLTP:
+				((float *) frame->data[ch])[i] = v;
+				break;
+			case AV_SAMPLE_FMT_FLT:
+				((float *) frame->data[0])[i * channels + ch] = v;
+				break;
+			case AV_SAMPLE_FMT_S16P:
+				((int16_t *) frame->data[ch])[i] = v * 32767;
+				break;
+			case AV_SAMPLE_FMT_S16:
+				((int16_t *) frame->data[0])[i * channels + ch] = v * 32767;
+				break;
+			case AV_SAMPLE_FMT_S32P:
+				((int32_t *) frame->data[ch])[i] = v * 2147483647.0;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+// feed one frame, or NULL to flush, and write every packet out of the encoder
+static int encode_write(AVFormatContext *oc, OutputStream *ost,
+		AVFrame *frame) {
+	AVPacket pkt;
+	int ret;
+
+	if ((ret = avcodec_send_frame(ost->enc, frame)) < 0) {
+		return ret;
+	}
+
+	for (;;) {
+		av_init_packet(&pkt);
+		pkt.data = NULL;
+		pkt.size = 0;
+
+		ret = avcodec_receive_packet(ost->enc, &pkt);
+		if (ret == AVERROR(EAGAIN)) {
+			return 0;
+		} else if (ret == AVERROR_EOF) {
+			ost->finished = 1;
+			return 0;
+		} else if (ret < 0) {
+			return ret;
+		}
+
+		av_packet_rescale_ts(&pkt, ost->enc->time_base, ost->st->time_base);
+		pkt.stream_index = ost->st->index;
+		if ((ret = av_interleaved_write_frame(oc, &pkt)) < 0) {
+			return ret;
+		}
+	}
+}
+
+// the next frame of a stream, NULL once the duration is written
+static AVFrame *next_frame(OutputStream *ost, double duration) {
+	AVFrame *frame = ost->frame;
+
+	if (av_compare_ts(ost->next_pts, ost->enc->time_base,
+			(int64_t) (duration * 1000), (AVRational ) { 1, 1000 }) >= 0) {
+		return NULL;
+	}
+
+	if (av_frame_make_writable(frame) < 0) {
+		return NULL;
+	}
+
+	if (ost->enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+		fill_picture(frame, ost->next_pts);
+		frame->pts = ost->next_pts++;
+	} else {
+		fill_tone(frame, ost->next_pts);
+		frame->pts = ost->next_pts;
+		ost->next_pts += frame->nb_samples;
+	}
+
+	return frame;
+}
+
+static int write_entry(const CorpusEntry *entry, const char *dir,
+		double duration) {
+	AVFormatContext *oc = NULL;
+	OutputStream video, audio, *ost;
+	char path[1024];
+	int ret;
+
+	memset(&video, 0, sizeof(video));
+	memset(&audio, 0, sizeof(audio));
+	snprintf(path, sizeof(path), "%s/%s", dir, entry->name);
+
+	ret = avformat_alloc_output_context2(&oc, NULL, NULL, path);
+	if (ret < 0) {
+		fprintf(stderr, "avsync-corpus: no muxer for %s\n", entry->name);
+		return ret;
+	}
+
+	if (((ret = open_stream(oc, &video, entry->video_codec, entry)) < 0)
+			|| ((ret = open_stream(oc, &audio, entry->audio_codec, entry))
+					< 0)) {
+		goto end;
+	}
+
+	if ((ret = avio_open(&oc->pb, path, AVIO_FLAG_WRITE)) < 0) {
+		fprintf(stderr, "avsync-corpus: can not open %s\n", path);
+		goto end;
+	}
+
+	if ((ret = avformat_write_header(oc, NULL)) < 0) {
+		goto end;
+	}
+
+	// interleave by time until both streams are flushed
+	while (!video.finished || !audio.finished) {
+		if (video.finished) {
+			ost = &audio;
+		} else if (audio.finished) {
+			ost = &video;
+		} else {
+			ost = av_compare_ts(video.next_pts, video.enc->time_base,
+					audio.next_pts, audio.enc->time_base) <= 0 ?
+					&video : &audio;
+		}
+
+		if ((ret = encode_write(oc, ost, next_frame(ost, duration))) < 0) {
+			goto end;
+		}
+	}
+
+	ret = av_write_trailer(oc);
+
+	end:
+
+	close_stream(&video);
+	close_stream(&audio);
+	if (oc->pb) {
+		avio_closep(&oc->pb);
+	}
+	avformat_free_context(oc);
+
+	if (ret < 0) {
+		unlink(path);
+	}
+
+	return ret;
+}
+
+static void usage() {
+	fprintf(stderr,
+			"usage: avsync-corpus [-a] [-d seconds] dir\n"
+			"  -a             also write the 2160p entries\n"
+			"  -d seconds     length of each file (10)\n");
+}
+
+int main(int argc, char **argv) {
+	double duration = 10;
+	int all = 0, c, written = 0;
+	size_t i;
+
+	while ((c = getopt(argc, argv, "ad:")) != -1) {
+		switch (c) {
+		case 'a':
+			all = 1;
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if ((optind != argc - 1) || (duration <= 0)) {
+		usage();
+		return 1;
+	}
+
+	av_register_all();
+	av_log_set_level(AV_LOG_ERROR);
+	mkdir(argv[optind], 0755);
+
+	// the written file names go to stdout, for the bench script
+	for (i = 0; i < FF_ARRAY_ELEMS(corpus); i++) {
+		if (corpus[i].large && !all) {
+			continue;
+		}
+
+		if (write_entry(&corpus[i], argv[optind], duration) < 0) {
+			fprintf(stderr, "avsync-corpus: skipped %s\n", corpus[i].name);
+			continue;
+		}
+		printf("%s/%s\n", argv[optind], corpus[i].name);
+		written++;
+	}
+
+	return written ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Writes the corpus once, plays every file of it headlessly and appends the
+# results to a json lines file, then compares them with a baseline if given.
+# With -H the corpus is served by a local http server on that port instead
+# and every file is played twice, from the network and then from the cache.
+#
+#   host/bench.sh [-a] [-b baseline.jsonl] [-o results.jsonl] [-H port]
+#       [corpus dir]
+
+HOST_DIR=$(dirname "$0")
+ALL=
+BASELINE=
+RESULTS=bench-results.jsonl
+HTTP_PORT=
+
+while getopts "ab:o:H:" opt; do
+	case $opt in
+	a) ALL=-a ;;
+	b) BASELINE=$OPTARG ;;
+	o) RESULTS=$OPTARG ;;
+	H) HTTP_PORT=$OPTARG ;;
+	*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+CORPUS=${1:-bench-corpus}
+
+if [ ! -d "$CORPUS" ] || [ -z "$(ls "$CORPUS")" ]; then
+	"$HOST_DIR/avsync-corpus" $ALL "$CORPUS" > /dev/null || exit 1
+fi
+
+rm -f "$RESULTS"
+if [ -n "$HTTP_PORT" ]; then
+	CACHE=$(mktemp -d)
+	python3 -m http.server -d "$CORPUS" -b 127.0.0.1 "$HTTP_PORT" \
+		> /dev/null 2>&1 &
+	SERVER=$!
+	trap 'kill $SERVER; rm -rf "$CACHE"' EXIT
+	sleep 1
+
+	for media in "$CORPUS"/*; do
+		url=http://127.0.0.1:$HTTP_PORT/$(basename "$media")
+		for pass in network cache; do
+			"$HOST_DIR/avsync-bench" -q -C "$CACHE" -j "$RESULTS" \
+				-n "$(basename "$media")@$pass" "$url" || \
+				echo "bench.sh: $url from the $pass failed" >&2
+		done
+	done
+else
+	for media in "$CORPUS"/*; do
+		"$HOST_DIR/avsync-bench" -q -j "$RESULTS" "$media" || \
+			echo "bench.sh: $media failed" >&2
+	done
+fi
+
+if [ -n "$BASELINE" ]; then
+	"$HOST_DIR/avsync-compare" "$BASELINE" "$RESULTS"
+fi
@@ -0,0 +1,9 @@
+#ifndef __HOST_CONFIG_H__
+#define __HOST_CONFIG_H__
+
+/* the few FFmpeg configure switches player.h reads, the android build
+ * takes them from the prebuilt FFmpeg config.h */
+#define CONFIG_AVDEVICE 0
+#define CONFIG_AVFILTER 1
+
+#endif /* __HOST_CONFIG_H__ */
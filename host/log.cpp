@@ -0,0 +1,23 @@
+#include <stdarg.h>
+
+#include "player.h"
+
+static const char *priority_names[] = { "", "", "V", "D", "I", "W", "E" };
+
+// logcat-like lines on stderr
+int log_print(int prio, const char *tag, const char *fmt, ...) {
+	va_list vl;
+	int ret;
+
+	if ((prio < ANDROID_LOG_VERBOSE) || (prio > ANDROID_LOG_ERROR)) {
+		prio = ANDROID_LOG_INFO;
+	}
+
+	fprintf(stderr, "%s/%s: ", priority_names[prio], tag);
+	va_start(vl, fmt);
+	ret = vfprintf(stderr, fmt, vl);
+	va_end(vl);
+	fputc('\n', stderr);
+
+	return ret;
+}
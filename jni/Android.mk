@@ -13,7 +13,8 @@ include $(CLEAR_VARS)
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/include
 
 LOCAL_MODULE    := avsync
-LOCAL_SRC_FILES := avsync-jni.cpp surface.cpp player.cpp util.cpp video.cpp audio.cpp shader.cpp
+LOCAL_SRC_FILES := avsync-jni.cpp surface.cpp player.cpp util.cpp video.cpp audio.cpp shader.cpp clock.cpp metrics.cpp trace.cpp scheduler.cpp io.cpp stream.cpp \
+	opensl.cpp sinks.cpp
 
 # for logging
 LOCAL_LDLIBS    += -llog
@@ -31,5 +32,9 @@ LOCAL_SHARED_LIBRARIES += libcutil
 LOCAL_SHARED_LIBRARIES += libstlport
 
 LOCAL_CFLAGS += -D__STDC_CONSTANT_MACROS=1
+# record pipeline trace events, see trace.cpp
+#LOCAL_CFLAGS += -DAVSYNC_TRACE=1
+# lowest log priority built in, release builds default to warnings
+#LOCAL_CFLAGS += -DAVSYNC_LOG_LEVEL=ANDROID_LOG_DEBUG
 
 include $(BUILD_SHARED_LIBRARY)
@@ -1,78 +1,82 @@
 #include <assert.h>
-#include <jni.h>
 #include <string.h>
 #include "player.h"
 
-// for native audio
-#include <SLES/OpenSLES.h>
-#include <SLES/OpenSLES_Android.h>
-
-#define AVCODEC_MAX_AUDIO_FRAME_SIZE 192000 // 1 second of 48khz 32bit audio
 #define DECODE_AUDIO_BUFFER_SIZE ((AVCODEC_MAX_AUDIO_FRAME_SIZE * 3) )
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
 /* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
 #define AUDIO_DIFF_AVG_NB   20
-#define AV_NOSYNC_THRESHOLD 10.0
-
-static AVFilterContext *in_audio_filter;  // the first filter in the audio chain
-static AVFilterContext *out_audio_filter;  // the last filter in the audio chain
-static AVFilterGraph *agraph;              // audio filter graph
-static struct AudioParams audio_filter_src;
-
-static double audio_clock;
-static double last_enqueue_buffer_time;
-static int last_enqueue_buffer_size;
-
-// engine interfaces
-static SLObjectItf engineObject = NULL;
-static SLEngineItf engineEngine;
-
-// output mix interfaces
-static SLObjectItf outputMixObject = NULL;
-static SLEnvironmentalReverbItf outputMixEnvironmentalReverb = NULL;
-
-// buffer queue player interfaces
-static SLObjectItf bqPlayerObject = NULL;
-static SLPlayItf bqPlayerPlay;
-static SLAndroidSimpleBufferQueueItf bqPlayerBufferQueue;
-static SLEffectSendItf bqPlayerEffectSend;
-static SLVolumeItf bqPlayerVolume;
-static uint8_t decoded_audio_buf[AVCODEC_MAX_AUDIO_FRAME_SIZE];
-
-double get_audio_clock() {
-	double pts;
-	int hw_buf_size, bytes_per_sec, n;
-
-	pts = audio_clock;
-
-	bytes_per_sec = 0;
-	n = global_context.acodec_ctx->channels * 2;
-	bytes_per_sec = global_context.acodec_ctx->sample_rate * n;
-	hw_buf_size = last_enqueue_buffer_size
-			- (double(av_gettime() - last_enqueue_buffer_time) / 1000000.0)
-					* bytes_per_sec;
-	if (bytes_per_sec) {
-		pts -= (double) hw_buf_size / bytes_per_sec;
+/* length of one buffer handed to the sink, small codec frames are batched */
+#define AUDIO_OUTPUT_PERIOD_MS 50
+/* one atempo instance handles tempo from 0.5 to 2.0 */
+#define ATEMPO_MIN 0.5
+#define ATEMPO_MAX 2.0
+/* weight of a new measure in the smoothed sink latency */
+#define AUDIO_LATENCY_SMOOTHING 0.1
+
+// the pts being heard now: the sample reached inside the buffer the sink is
+// consuming, less the smoothed latency measured with GetPosition()
+double get_audio_clock(Player *player) {
+	AudioOutputBuffer *buf;
+	double pts, elapsed, duration;
+
+	pthread_mutex_lock(&player->audio_clock_mutex);
+
+	if (0 == player->output_count) {
+		// not started or underrun, nothing is playing so hold the clock
+		pts = player->audio_clock_last;
+	} else {
+		buf = &player->output_buffers[player->output_rindex];
+		duration = (double) buf->nb_samples / player->audio_filter_src.freq;
+		elapsed = (av_gettime_relative() - player->audio_played_time)
+				/ 1000000.0;
+		pts = buf->pts
+				+ (av_clipd(elapsed, 0, duration) - player->audio_latency)
+						* buf->speed;
+
+		// never step back because of latency jitter, unless pts jumped
+		if (!isnan(player->audio_clock_last) && (pts < player->audio_clock_last)
+				&& (player->audio_clock_last - pts < AV_NOSYNC_THRESHOLD)) {
+			pts = player->audio_clock_last;
+		}
+		player->audio_clock_last = pts;
 	}
 
+	pthread_mutex_unlock(&player->audio_clock_mutex);
+
 	return pts;
 }
 
+static double audio_clock_source(void *opaque) {
+	return get_audio_clock((Player*) opaque);
+}
 
-static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
-		AVFilterContext **sink) {
+// the audio clock reads the sink position instead of being set
+void init_audio_clock(Player *player) {
+	init_clock(&player->audclk, &player->audio_queue.serial);
+	set_clock_source(&player->audclk, audio_clock_source, player);
+}
+
+// the graph is returned even on failure, for the caller to free it
+static int init_filter_graph(Player *player, AVFilterGraph **graph,
+		AVFilterContext **src, AVFilterContext **sink) {
 	AVFilterGraph *filter_graph;
 	AVFilterContext *abuffer_ctx;
-	AVFilter *abuffer;
+	const AVFilter *abuffer;
 	AVFilterContext *aformat_ctx;
-	AVFilter *aformat;
+	const AVFilter *aformat;
 	AVFilterContext *abuffersink_ctx;
-	AVFilter *abuffersink;
+	const AVFilter *abuffersink;
+	AVFilterContext *atempo_ctx;
+	const AVFilter *atempo;
+	AVFilterContext *last_ctx;
 
 	char options_str[1024];
 	char ch_layout[64];
+	char name[16];
+	double tempo, step;
 
-	int err;
+	int i, err;
 
 	/* Create a new filtergraph, which will contain all the filters. */
 	filter_graph = avfilter_graph_alloc();
@@ -80,6 +84,7 @@ static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
 		av_log(NULL, AV_LOG_ERROR, "Unable to create filter graph.\n");
 		return AVERROR(ENOMEM);
 	}
+	*graph = filter_graph;
 
 	/* Create the abuffer filter;
 	 * it will be used for feeding the data into the graph. */
@@ -98,16 +103,16 @@ static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
 
 	/* Set the filter options through the AVOptions API. */
 	av_get_channel_layout_string(ch_layout, sizeof(ch_layout), (int) 0,
-			audio_filter_src.channel_layout);
+			player->audio_filter_src.channel_layout);
 	av_opt_set(abuffer_ctx, "channel_layout", ch_layout,
 			AV_OPT_SEARCH_CHILDREN);
 	av_opt_set(abuffer_ctx, "sample_fmt",
-			av_get_sample_fmt_name(audio_filter_src.fmt),
+			av_get_sample_fmt_name(player->audio_filter_src.fmt),
 			AV_OPT_SEARCH_CHILDREN);
 	av_opt_set_q(abuffer_ctx, "time_base",
-			(AVRational ) { 1, audio_filter_src.freq },
+			(AVRational ) { 1, player->audio_filter_src.freq },
 			AV_OPT_SEARCH_CHILDREN);
-	av_opt_set_int(abuffer_ctx, "sample_rate", audio_filter_src.freq,
+	av_opt_set_int(abuffer_ctx, "sample_rate", player->audio_filter_src.freq,
 			AV_OPT_SEARCH_CHILDREN);
 
 	/* Now initialize the filter; we pass NULL options, since we have already
@@ -119,6 +124,50 @@ static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
 		return err;
 	}
 
+	/* Chain atempo filters for the playback rate, it stretches time
+	 * and keeps the pitch. There is none at rate 1.0, so builds without
+	 * atempo still play. */
+	atempo = NULL;
+	last_ctx = abuffer_ctx;
+	tempo = player->audio_filter_rate;
+	for (i = 0; fabs(tempo - 1.0) > 0.001; i++) {
+		if (NULL == atempo) {
+			atempo = avfilter_get_by_name("atempo");
+			if (!atempo) {
+				av_log(NULL, AV_LOG_ERROR,
+						"Could not find the atempo filter.\n");
+				return AVERROR_FILTER_NOT_FOUND ;
+			}
+		}
+
+		step = av_clipd(tempo, ATEMPO_MIN, ATEMPO_MAX);
+
+		snprintf(name, sizeof(name), "atempo%d", i);
+		atempo_ctx = avfilter_graph_alloc_filter(filter_graph, atempo, name);
+		if (!atempo_ctx) {
+			av_log(NULL, AV_LOG_ERROR,
+					"Could not allocate the atempo instance.\n");
+			return AVERROR(ENOMEM);
+		}
+
+		snprintf(options_str, sizeof(options_str), "tempo=%f", step);
+		err = avfilter_init_str(atempo_ctx, options_str);
+		if (err < 0) {
+			av_log(NULL, AV_LOG_ERROR,
+					"Could not initialize the atempo filter.\n");
+			return err;
+		}
+
+		err = avfilter_link(last_ctx, 0, atempo_ctx, 0);
+		if (err < 0) {
+			av_log(NULL, AV_LOG_ERROR, "Error connecting filters\n");
+			return err;
+		}
+
+		last_ctx = atempo_ctx;
+		tempo /= step;
+	}
+
 	/* Create the aformat filter;
 	 * it ensures that the output is of the format we want. */
 	aformat = avfilter_get_by_name("aformat");
@@ -138,8 +187,9 @@ static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
 	 * key1=value1:key2=value2.... */
 	snprintf(options_str, sizeof(options_str),
 			"sample_fmts=%s:sample_rates=%d:channel_layouts=0x%x",
-			av_get_sample_fmt_name(AV_SAMPLE_FMT_S16), audio_filter_src.freq,
-			audio_filter_src.channel_layout);
+			av_get_sample_fmt_name(AV_SAMPLE_FMT_S16),
+			player->audio_filter_src.freq,
+			player->audio_filter_src.channel_layout);
 	err = avfilter_init_str(aformat_ctx, options_str);
 	if (err < 0) {
 		av_log(NULL, AV_LOG_ERROR,
@@ -173,7 +223,7 @@ static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
 
 	/* Connect the filters;
 	 * in this simple case the filters just form a linear chain. */
-	err = avfilter_link(abuffer_ctx, 0, aformat_ctx, 0);
+	err = avfilter_link(last_ctx, 0, aformat_ctx, 0);
 	if (err >= 0) {
 		err = avfilter_link(aformat_ctx, 0, abuffersink_ctx, 0);
 	}
@@ -190,7 +240,6 @@ static int init_filter_graph(AVFilterGraph **graph, AVFilterContext **src,
 		return err;
 	}
 
-	*graph = filter_graph;
 	*src = abuffer_ctx;
 	*sink = abuffersink_ctx;
 
@@ -207,354 +256,610 @@ static inline int64_t get_valid_channel_layout(int64_t channel_layout,
 	}
 }
 
-// decode a new packet(not multi-frame)
-// return decoded frame size, not decoded packet size
-int audio_decode_frame(uint8_t *audio_buf, int buf_size) {
-	static AVPacket pkt;
-	static uint8_t *audio_pkt_data = NULL;
-	static int audio_pkt_size = 0;
-	int len1, data_size;
-	int got_frame;
-	AVFrame * frame = NULL;
-	static int reconfigure = 1;
-	int ret = -1;
+/* return the wanted number of samples to get better sync if sync_type is video
+ * or external master clock */
+static int synchronize_audio(Player *player, int nb_samples) {
+	int wanted_nb_samples = nb_samples;
+	int min_nb_samples, max_nb_samples;
+	double diff, avg_diff;
+
+	if (get_master_sync_type(player) == AV_SYNC_AUDIO_MASTER) {
+		return wanted_nb_samples;
+	}
+
+	diff = get_audio_clock(player) - get_master_clock(player);
+
+	if (!isnan(diff) && (fabs(diff) < AV_NOSYNC_THRESHOLD)) {
+		player->audio_diff_cum = diff
+				+ player->audio_diff_avg_coef * player->audio_diff_cum;
+		if (player->audio_diff_avg_count < AUDIO_DIFF_AVG_NB) {
+			/* not enough measures to have a correct estimate */
+			player->audio_diff_avg_count++;
+		} else {
+			/* estimate the A-V difference */
+			avg_diff = player->audio_diff_cum
+					* (1.0 - player->audio_diff_avg_coef);
+
+			if (fabs(avg_diff) >= player->audio_diff_threshold) {
+				wanted_nb_samples = nb_samples
+						+ (int) (diff * player->audio_filter_src.freq
+								/ player->audio_filter_rate);
+				min_nb_samples = ((nb_samples
+						* (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
+				max_nb_samples = ((nb_samples
+						* (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
+				wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples,
+						max_nb_samples);
+			}
+		}
+	} else {
+		/* too big difference : may be initial PTS errors, so reset A-V filter */
+		player->audio_diff_avg_count = 0;
+		player->audio_diff_cum = 0;
+	}
+
+	return wanted_nb_samples;
+}
+
+// resample one filtered frame by the sync correction and put it in the fifo,
+// the change is spread over the frame so no samples are dropped or repeated
+static int compensate_audio_frame(Player *player, AVFrame *frame) {
+	int wanted_nb_samples = synchronize_audio(player, frame->nb_samples);
+	int out_count = wanted_nb_samples + 256;
+	int out_size, len2;
+
+	if (wanted_nb_samples != frame->nb_samples) {
+		if (swr_set_compensation(player->swr_ctx,
+				wanted_nb_samples - frame->nb_samples, wanted_nb_samples)
+				< 0) {
+			av_log(NULL, AV_LOG_ERROR, "swr_set_compensation failure. \n");
+			return -1;
+		}
+	}
+
+	out_size = av_samples_get_buffer_size(NULL,
+			player->audio_filter_src.channels, out_count, AV_SAMPLE_FMT_S16, 0);
+	if (out_size < 0) {
+		av_log(NULL, AV_LOG_ERROR, "av_samples_get_buffer_size failure. \n");
+		return -1;
+	}
+
+	av_fast_malloc(&player->audio_buf1, &player->audio_buf1_size, out_size);
+	if (NULL == player->audio_buf1) {
+		return AVERROR(ENOMEM);
+	}
+
+	len2 = swr_convert(player->swr_ctx, &player->audio_buf1, out_count,
+			(const uint8_t **) frame->extended_data, frame->nb_samples);
+	if (len2 < 0) {
+		av_log(NULL, AV_LOG_ERROR, "swr_convert failure. \n");
+		return -1;
+	}
+
+	if (av_audio_fifo_write(player->audio_fifo, (void **) &player->audio_buf1,
+			len2) < len2) {
+		av_log(NULL, AV_LOG_ERROR, "av_audio_fifo_write :  failure. \n");
+		return AVERROR(ENOMEM);
+	}
+
+	return 0;
+}
+
+// pull every frame the filter graph has ready into the output fifo
+static int drain_audio_filter(Player *player, AVFrame *frame) {
+	int ret;
 
 	for (;;) {
+		ret = av_buffersink_get_frame(player->out_audio_filter, frame);
+		if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF)) {
+			return 0;
+		}
 
-		while (audio_pkt_size > 0) {
+		if (ret < 0) {
+			av_log(NULL, AV_LOG_ERROR,
+					"av_buffersink_get_frame :  failure. \n");
+			return ret;
+		}
 
-			if (NULL == frame) {
-				frame = av_frame_alloc();
+		if (get_master_sync_type(player) != AV_SYNC_AUDIO_MASTER) {
+			if ((ret = compensate_audio_frame(player, frame)) < 0) {
+				av_frame_unref(frame);
+				return ret;
 			}
+		} else if (av_audio_fifo_write(player->audio_fifo,
+				(void **) frame->data, frame->nb_samples) < frame->nb_samples) {
+			av_log(NULL, AV_LOG_ERROR, "av_audio_fifo_write :  failure. \n");
+			av_frame_unref(frame);
+			return AVERROR(ENOMEM);
+		}
 
-			data_size = buf_size;
-			got_frame = 0;
+		// output pts count from the start of the graph at the speed of the
+		// rate, so the samples atempo holds back are not on the clock yet
+		if (frame->pts != AV_NOPTS_VALUE) {
+			player->audio_fifo_clock = player->audio_filter_start
+					+ (frame->pts * av_q2d(
+							player->out_audio_filter->inputs[0]->time_base)
+							+ (double) frame->nb_samples / frame->sample_rate)
+							* player->audio_filter_rate;
+		} else {
+			player->audio_fifo_clock += (double) frame->nb_samples
+					/ frame->sample_rate * player->audio_filter_rate;
+		}
+		av_frame_unref(frame);
+	}
 
-			// len1 is decoded packet size
-			len1 = avcodec_decode_audio4(global_context.acodec_ctx, frame,
-					&got_frame, &pkt);
-			if (got_frame) {
+	return 0;
+}
 
-				if (reconfigure) {
+// no frame is filtered until a graph is built again
+static void free_audio_filter(Player *player) {
+	avfilter_graph_free(&player->agraph);
+	player->in_audio_filter = NULL;
+	player->out_audio_filter = NULL;
+}
 
-					reconfigure = 0;
-					int64_t dec_channel_layout = get_valid_channel_layout(
-							frame->channel_layout,
-							av_frame_get_channels(frame));
+// rebuild the graph when the playback rate changed, the samples still
+// inside the old graph are flushed to the fifo first
+static int update_audio_filter_rate(Player *player) {
+	double rate = player->playback_rate;
+	AVFrame *frame;
+	int ret;
 
-					// used by init_filter_graph()
-					audio_filter_src.fmt = (enum AVSampleFormat) frame->format;
-					audio_filter_src.channels = av_frame_get_channels(frame);
-					audio_filter_src.channel_layout = dec_channel_layout;
-					audio_filter_src.freq = frame->sample_rate;
+	if ((rate == player->audio_filter_rate)
+			|| (NULL == player->in_audio_filter)) {
+		return 0;
+	}
 
-					init_filter_graph(&agraph, &in_audio_filter,
-							&out_audio_filter);
-				}
+	frame = av_frame_alloc();
+	if (NULL == frame) {
+		return AVERROR(ENOMEM);
+	}
 
-				if ((ret = av_buffersrc_add_frame(in_audio_filter, frame))
-						< 0) {
-					av_log(NULL, AV_LOG_ERROR,
-							"av_buffersrc_add_frame :  failure. \n");
-					return ret;
-				}
+	av_buffersrc_add_frame(player->in_audio_filter, NULL);
+	drain_audio_filter(player, frame);
+	av_frame_free(&frame);
+
+	avfilter_graph_free(&player->agraph);
+	player->audio_filter_rate = rate;
+	player->audio_filter_start = NAN;
+
+	ret = init_filter_graph(player, &player->agraph, &player->in_audio_filter,
+			&player->out_audio_filter);
+	if (ret < 0) {
+		free_audio_filter(player);
+	}
+	return ret;
+}
+
+// configure the filter graph and output fifo from the first decoded frame,
+// on failure there is no graph and the frames are dropped
+static int configure_audio_output(Player *player, AVFrame *frame) {
+	int64_t dec_channel_layout = get_valid_channel_layout(frame->channel_layout,
+			av_frame_get_channels(frame));
+	int ret;
+
+	// used by init_filter_graph()
+	player->audio_filter_src.fmt = (enum AVSampleFormat) frame->format;
+	player->audio_filter_src.channels = av_frame_get_channels(frame);
+	player->audio_filter_src.channel_layout = dec_channel_layout;
+	player->audio_filter_src.freq = frame->sample_rate;
+	player->audio_filter_rate = player->playback_rate;
+	player->audio_filter_start = NAN;
+
+	if ((ret = init_filter_graph(player, &player->agraph,
+			&player->in_audio_filter, &player->out_audio_filter)) < 0) {
+		free_audio_filter(player);
+		return ret;
+	}
+
+	player->audio_fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_S16,
+			player->audio_filter_src.channels, player->audio_filter_src.freq);
+	if (NULL == player->audio_fifo) {
+		av_log(NULL, AV_LOG_ERROR, "av_audio_fifo_alloc failure. \n");
+		free_audio_filter(player);
+		return AVERROR(ENOMEM);
+	}
+
+	// same format in and out, it only acts once a compensation is set
+	if (!dec_channel_layout) {
+		dec_channel_layout = av_get_default_channel_layout(
+				player->audio_filter_src.channels);
+	}
+	player->swr_ctx = swr_alloc_set_opts(NULL, dec_channel_layout,
+			AV_SAMPLE_FMT_S16, player->audio_filter_src.freq,
+			dec_channel_layout, AV_SAMPLE_FMT_S16,
+			player->audio_filter_src.freq, 0, NULL);
+	if ((NULL == player->swr_ctx) || (swr_init(player->swr_ctx) < 0)) {
+		av_log(NULL, AV_LOG_ERROR, "swr_init failure. \n");
+		swr_free(&player->swr_ctx);
+		free_audio_filter(player);
+		return AVERROR(EINVAL);
+	}
+
+	/* averaging filter for audio sync */
+	player->audio_diff_avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
+	player->audio_diff_avg_count = 0;
+	player->audio_diff_cum = 0;
+	/* since we do not have a precise enough audio fifo fullness,
+	 we correct audio sync only if larger than this threshold */
+	player->audio_diff_threshold = AUDIO_OUTPUT_PERIOD_MS / 1000.0;
+
+	return 0;
+}
+
+// the filter graph broke, audio can not go on: it ends with what is in the
+// fifo and the external clock takes over from the audio clock
+static void fail_audio_output(Player *player) {
+	double clock = get_clock(&player->audclk);
+
+	av_log(NULL, AV_LOG_ERROR, "audio output failure, audio ends. \n");
+	if (!isnan(clock)) {
+		set_clock(&player->extclk, clock, player->extclk.serial);
+	}
+	player->audio_failed = 1;
+	player->audio_finished = 1;
+}
+
+// decode packets until one output period of samples has been filtered,
+// return the size of the data copied to audio_buf. Without block 0 means
+// the queue ran dry first, the decoded samples wait in the fifo.
+static int audio_decode_frame(Player *player, uint8_t *audio_buf,
+		int buf_size, int block) {
+	AVPacket pkt;
+	AVFrame *frame = NULL;
+	int frame_bytes, period;
+	double pts;
+	int ret = -1;
+
+	frame = av_frame_alloc();
+	if (NULL == frame) {
+		return AVERROR(ENOMEM);
+	}
+
+	for (;;) {
+
+		if (NULL != player->audio_fifo) {
+			// batch small codec frames into one output period
+			frame_bytes = player->audio_filter_src.channels
+					* av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+			period = player->audio_filter_src.freq * AUDIO_OUTPUT_PERIOD_MS
+					/ 1000;
+			if (period > buf_size / frame_bytes) {
+				period = buf_size / frame_bytes;
+			}
 
-				if ((ret = av_buffersink_get_frame(out_audio_filter, frame))
-						< 0) {
-					av_log(NULL, AV_LOG_ERROR,
-							"av_buffersink_get_frame :  failure. \n");
-					continue;
+			// at end of stream hand out whatever is left
+			if (player->audio_finished) {
+				period = FFMIN(period, av_audio_fifo_size(player->audio_fifo));
+			}
+
+			if ((period > 0)
+					&& (av_audio_fifo_size(player->audio_fifo) >= period)) {
+				ret = av_audio_fifo_read(player->audio_fifo, (void **) &audio_buf,
+						period);
+				if (ret > 0) {
+					player->audio_clock = player->audio_fifo_clock
+							- (double) av_audio_fifo_size(player->audio_fifo)
+									/ player->audio_filter_src.freq
+									* player->audio_filter_rate;
+					ret *= frame_bytes;
 				}
+				break;
+			}
+		}
+
+		if (player->audio_finished) {
+			ret = -1;
+			break;
+		}
 
-				data_size = av_samples_get_buffer_size(NULL, frame->channels,
-						frame->nb_samples, (enum AVSampleFormat) frame->format,
-						1);
+		// one packet may give many frames, take them all before sending more
+		ret = avcodec_receive_frame(player->acodec_ctx, frame);
+		if (ret >= 0) {
 
-				// len1 is decoded packet size
-				// < 0  means failure or error，so break to get a new packet
-				if (len1 < 0) {
-					audio_pkt_size = 0;
-					av_log(NULL, AV_LOG_ERROR,
-							"avcodec_decode_audio4 failure. \n");
+			if (player->audio_reconfigure) {
+				player->audio_reconfigure = 0;
+				if ((ret = configure_audio_output(player, frame)) < 0) {
+					fail_audio_output(player);
 					break;
 				}
+			}
 
-				// decode ok, sync audio, just give synced size
-				//synchronize_audio((int16_t *)audio_buf, data_size);
+			// the output could not be configured, there is nowhere to go
+			if (NULL == player->in_audio_filter) {
+				av_frame_unref(frame);
+				continue;
+			}
 
-				// decoded data to audio buf
-				memcpy(audio_buf, frame->data[0], data_size);
+			// the old graph is drained at the old rate before this frame
+			if ((ret = update_audio_filter_rate(player)) < 0) {
+				av_log(NULL, AV_LOG_ERROR,
+						"update_audio_filter_rate :  failure. \n");
+				fail_audio_output(player);
+				break;
+			}
 
-				audio_pkt_data += len1;
-				audio_pkt_size -= len1;
+			// in the graph, pts are samples since its first frame
+			pts = stream_timestamp_to_seconds(player, player->astream,
+					av_frame_get_best_effort_timestamp(frame),
+					&player->audio_last_ts);
+			if (isnan(player->audio_filter_start)) {
+				player->audio_filter_start = isnan(pts) ?
+						player->audio_fifo_clock : pts;
+				player->audio_filter_next_pts = 0;
+			}
+			frame->pts = isnan(pts) ? player->audio_filter_next_pts :
+					llrint((pts - player->audio_filter_start)
+							* player->audio_filter_src.freq);
+			player->audio_filter_next_pts = frame->pts + frame->nb_samples;
+
+			if ((ret = av_buffersrc_add_frame(player->in_audio_filter, frame))
+					< 0) {
+				av_log(NULL, AV_LOG_ERROR,
+						"av_buffersrc_add_frame :  failure. \n");
+				fail_audio_output(player);
+				break;
+			}
 
-				int n = 2 * global_context.acodec_ctx->channels;
-				audio_clock += (double) data_size
-						/ (double) (n * global_context.acodec_ctx->sample_rate); // add bytes offset
-				//LOGV2("audio_decode_frame: 2 pts is %lld, %lf", pkt.pts, audio_clock);
-				av_free_packet(&pkt);
-				av_frame_free(&frame);
+			// the graph may buffer or split frames, so take all it has
+			if ((ret = drain_audio_filter(player, frame)) < 0) {
+				fail_audio_output(player);
+				break;
+			}
+			continue;
+		}
 
-				return data_size;
-			} else if (len1 < 0) {
-				char errbuf[64];
-				av_strerror(ret, errbuf, 64);
-				LOGV2("avcodec_decode_audio4 ret < 0, %s", errbuf);
+		if (ret == AVERROR_EOF) {
+			// decoder is drained, flush the samples still in the graph
+			player->audio_finished = 1;
+			if (NULL != player->in_audio_filter) {
+				av_buffersrc_add_frame(player->in_audio_filter, NULL);
+				drain_audio_filter(player, frame);
 			}
+			LOGV2("audio_decode_frame : end of stream.");
+			continue;
 		}
 
-		av_free_packet(&pkt);
-		av_frame_free(&frame);
+		if (ret != AVERROR(EAGAIN)) {
+			char errbuf[64];
+			av_strerror(ret, errbuf, 64);
+			LOGE2("avcodec_receive_frame ret < 0, %s", errbuf);
+		}
 
 		// get a new packet
-		if (packet_queue_get(&global_context.audio_queue, &pkt) < 0) {
-			return -1;
+		ret = packet_queue_get(&player->audio_queue, &pkt, block);
+		if (ret <= 0) {
+			break;
 		}
+		wake_demux(player);
 
-		//LOGV2("pkt.size is %d", pkt.size);
-
-		audio_pkt_data = pkt.data;
-		audio_pkt_size = pkt.size;
+		// an empty packet marks the end of stream, it enters draining mode
+		if ((NULL == pkt.data) && (0 == pkt.size)) {
+			ret = avcodec_send_packet(player->acodec_ctx, NULL);
+		} else {
+			ret = avcodec_send_packet(player->acodec_ctx, &pkt);
+		}
 
-		// save current pts clock
-		if (pkt.pts != AV_NOPTS_VALUE ) {
-			audio_clock = pkt.pts * av_q2d(global_context.astream->time_base);
-			//LOGV2("audio_decode_frame: 1 pts is %lld, %lf", pkt.pts, audio_clock);
+		if (ret < 0) {
+			char errbuf[64];
+			av_strerror(ret, errbuf, 64);
+			LOGE2("avcodec_send_packet ret < 0, %s", errbuf);
 		}
+
+		av_packet_unref(&pkt);
 	}
 
+	av_frame_free(&frame);
+
 	return ret;
 }
 
-// this callback handler is called every time a buffer finishes playing
-void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context) {
-	SLresult result;
+// the sink consumed the head buffer, account its frames
+static void audio_buffer_played(Player *player) {
+	int64_t position;
+	double latency;
 
-	//LOGV2("bqPlayerCallback...");
+	position = player->audio_sink_opened ?
+			player->audio_sink->get_position(player) : -1;
 
-	if (bq != bqPlayerBufferQueue) {
-		LOGV2("bqPlayerCallback : not the same player object.");
-		return;
+	pthread_mutex_lock(&player->audio_clock_mutex);
+
+	if (player->output_count > 0) {
+		player->audio_frames_played +=
+				player->output_buffers[player->output_rindex].nb_samples;
+		if (++player->output_rindex >= AUDIO_OUTPUT_BUFFERS) {
+			player->output_rindex = 0;
+		}
+		player->output_count--;
+		player->audio_played_time = av_gettime_relative();
+
+		if ((0 == player->output_count) && !player->audio_finished) {
+			metrics_count(&player->metrics, METRIC_AUDIO_UNDERRUNS);
+		}
 	}
 
-	int decoded_size = audio_decode_frame(decoded_audio_buf,
-			sizeof(decoded_audio_buf));
-	if (decoded_size > 0) {
-		result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue,
-				decoded_audio_buf, decoded_size);
-		last_enqueue_buffer_time = av_gettime();
-		last_enqueue_buffer_size = decoded_size;
-		// the most likely other result is SL_RESULT_BUFFER_INSUFFICIENT,
-		// which for this code example would indicate a programming error
-		if (SL_RESULT_SUCCESS != result) {
-			LOGV2("bqPlayerCallback : bqPlayerBufferQueue Enqueue failure.");
+	// consumed frames are still in the mixer, position is what was played
+	if (position >= 0) {
+		latency = (double) player->audio_frames_played
+				/ player->audio_filter_src.freq - position / 1000.0;
+		if ((latency >= 0) && (latency < 1.0)) {
+			player->audio_latency += (latency - player->audio_latency)
+					* AUDIO_LATENCY_SMOOTHING;
 		}
 	}
-}
 
-int createEngine() {
+	pthread_mutex_unlock(&player->audio_clock_mutex);
+}
 
-	SLresult result;
+// decode one period into the next free buffer and queue it, return 1 when
+// queued, 0 when there is nothing yet or, without block, the sink callback
+// holds the decoder, and < 0 at the end
+static int enqueue_audio_buffer(Player *player, int block) {
+	uint8_t *buf;
+	int decoded_size, nb_samples, windex, ret;
 
-	// create engine
-	result = slCreateEngine(&engineObject, 0, NULL, 0, NULL, NULL);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("slCreateEngine failure.");
+	// a sink that failed to open or was closed takes nothing
+	if (!player->audio_sink_opened) {
 		return -1;
 	}
 
-	// realize the engine
-	result = (*engineObject)->Realize(engineObject, SL_BOOLEAN_FALSE );
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("engineObject Realize failure.");
-		(*engineObject)->Destroy(engineObject);
-		engineObject = NULL;
-		engineEngine = NULL;
-		return -1;
+	if (block) {
+		pthread_mutex_lock(&player->audio_enqueue_mutex);
+	} else if (pthread_mutex_trylock(&player->audio_enqueue_mutex) != 0) {
+		return 0;
 	}
 
-	// get the engine interface, which is needed in order to create other objects
-	result = (*engineObject)->GetInterface(engineObject, SL_IID_ENGINE,
-			&engineEngine);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("engineObject GetInterface failure.");
-		(*engineObject)->Destroy(engineObject);
-		engineObject = NULL;
-		engineEngine = NULL;
-		return -1;
-	}
+	windex = player->output_windex;
+	buf = player->decoded_audio_buf[windex];
 
-	// create output mix, with environmental reverb specified as a non-required interface
-	const SLInterfaceID ids[1] = { SL_IID_ENVIRONMENTALREVERB };
-	const SLboolean req[1] = { SL_BOOLEAN_FALSE };
-	result = (*engineEngine)->CreateOutputMix(engineEngine, &outputMixObject, 1,
-			ids, req);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("engineObject CreateOutputMix failure.");
-		(*engineObject)->Destroy(engineObject);
-		engineObject = NULL;
-		engineEngine = NULL;
-		return -1;
+	TRACE_BEGIN("audio_decode");
+	decoded_size = audio_decode_frame(player, buf,
+			sizeof(player->decoded_audio_buf[0]), block);
+	TRACE_END("audio_decode");
+	ret = (decoded_size > 0) ? 1 : decoded_size;
+	if (decoded_size > 0) {
+		nb_samples = decoded_size
+				/ (player->audio_filter_src.channels
+						* av_get_bytes_per_sample(AV_SAMPLE_FMT_S16));
+
+		pthread_mutex_lock(&player->audio_clock_mutex);
+		// player->audio_clock is the pts at the end of the decoded data
+		player->output_buffers[windex].pts = player->audio_clock
+				- (double) nb_samples / player->audio_filter_src.freq
+						* player->audio_filter_rate;
+		player->output_buffers[windex].nb_samples = nb_samples;
+		player->output_buffers[windex].speed = player->audio_filter_rate;
+		if (0 == player->output_count) {
+			player->audio_played_time = av_gettime_relative();
+		}
+		if (++player->output_windex >= AUDIO_OUTPUT_BUFFERS) {
+			player->output_windex = 0;
+		}
+		player->output_count++;
+		pthread_mutex_unlock(&player->audio_clock_mutex);
+
+		if (player->audio_sink->enqueue(player, buf, decoded_size) < 0) {
+			LOGE2("enqueue_audio_buffer : %s enqueue failure.",
+					player->audio_sink->name);
+			pthread_mutex_lock(&player->audio_clock_mutex);
+			player->output_windex = windex;
+			player->output_count--;
+			pthread_mutex_unlock(&player->audio_clock_mutex);
+			ret = -1;
+		}
 	}
 
-	// realize the output mix
-	result = (*outputMixObject)->Realize(outputMixObject, SL_BOOLEAN_FALSE );
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("outputMixObject Realize failure.");
+	pthread_mutex_unlock(&player->audio_enqueue_mutex);
+	return ret;
+}
 
-		(*outputMixObject)->Destroy(outputMixObject);
-		outputMixObject = NULL;
-		outputMixEnvironmentalReverb = NULL;
-		(*engineObject)->Destroy(engineObject);
-		engineObject = NULL;
-		engineEngine = NULL;
-		return -1;
-	}
+// called by the sink every time a buffer finishes playing
+void audio_sink_callback(Player *player) {
+	TRACE_BEGIN("audio_callback");
+	audio_buffer_played(player);
+	enqueue_audio_buffer(player, 1);
 
-	// get the environmental reverb interface
-	// this could fail if the environmental reverb effect is not available,
-	// either because the feature is not present, excessive CPU load, or
-	// the required MODIFY_AUDIO_SETTINGS permission was not requested and granted
-	result = (*outputMixObject)->GetInterface(outputMixObject,
-			SL_IID_ENVIRONMENTALREVERB, &outputMixEnvironmentalReverb);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("outputMixObject Realize failure.");
-		(*outputMixObject)->Destroy(outputMixObject);
-		outputMixObject = NULL;
-		outputMixEnvironmentalReverb = NULL;
-		(*engineObject)->Destroy(engineObject);
-		engineObject = NULL;
-		engineEngine = NULL;
-		return -1;
-	}
-
-	LOGV2("OpenSL ES createEngine success.");
-	return 0;
+	sync_clock_to_slave(&player->extclk, &player->audclk);
+	TRACE_END("audio_callback");
 }
 
-int createBufferQueueAudioPlayer() {
-	SLresult result;
-	SLuint32 channelMask;
-
-	// configure audio source
-	SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
-			SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2 };
-
-	if (global_context.acodec_ctx->channels == 2)
-		channelMask = SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
-	else
-		channelMask = SL_SPEAKER_FRONT_CENTER;
-
-	SLDataFormat_PCM format_pcm = { SL_DATAFORMAT_PCM,
-			global_context.acodec_ctx->channels,
-			global_context.acodec_ctx->sample_rate * 1000,
-			SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16,
-			channelMask, SL_BYTEORDER_LITTLEENDIAN };
-
-	SLDataSource audioSrc = { &loc_bufq, &format_pcm };
-
-	// configure audio sink
-	SLDataLocator_OutputMix loc_outmix = { SL_DATALOCATOR_OUTPUTMIX,
-			outputMixObject };
-	SLDataSink audioSnk = { &loc_outmix, NULL };
-
-	// create audio player
-	const SLInterfaceID ids[3] = { SL_IID_BUFFERQUEUE, SL_IID_EFFECTSEND,
-			SL_IID_VOLUME };
-	const SLboolean req[3] =
-			{ SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE };
-	result = (*engineEngine)->CreateAudioPlayer(engineEngine, &bqPlayerObject,
-			&audioSrc, &audioSnk, 3, ids, req);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("CreateAudioPlayer failure.");
-		return -1;
-	}
+// start the sink, it pulls the first buffers from fireOnPlayer()
+int open_audio_sink(Player *player) {
+	AudioSink *sink = player->audio_sink;
 
-	// realize the player
-	result = (*bqPlayerObject)->Realize(bqPlayerObject, SL_BOOLEAN_FALSE );
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject Realize failure.");
+	if (sink->open(player, player->acodec_ctx->sample_rate,
+			player->acodec_ctx->channels) < 0) {
+		LOGE2("open_audio_sink : %s open failure.", sink->name);
+		sink->close(player);
 		return -1;
 	}
 
-	// get the play interface
-	result = (*bqPlayerObject)->GetInterface(bqPlayerObject, SL_IID_PLAY,
-			&bqPlayerPlay);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject GetInterface failure.");
-		return -1;
-	}
+	player->audio_sink_opened = 1;
+	return 0;
+}
 
-	// get the buffer queue interface
-	result = (*bqPlayerObject)->GetInterface(bqPlayerObject, SL_IID_BUFFERQUEUE,
-			&bqPlayerBufferQueue);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject GetInterface failure.");
-		return -1;
+void close_audio_sink(Player *player) {
+	if (player->audio_sink_opened) {
+		player->audio_sink->close(player);
+		player->audio_sink_opened = 0;
 	}
+}
 
-	// register callback on the buffer queue
-	result = (*bqPlayerBufferQueue)->RegisterCallback(bqPlayerBufferQueue,
-			bqPlayerCallback, NULL);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject RegisterCallback failure.");
-		return -1;
-	}
+// free the filter graph and buffers, once the sink is closed
+void close_audio_output(Player *player) {
+	free_audio_filter(player);
+	av_audio_fifo_free(player->audio_fifo);
+	player->audio_fifo = NULL;
+	swr_free(&player->swr_ctx);
+	av_freep(&player->audio_buf1);
+	player->audio_buf1_size = 0;
+}
 
-	// get the effect send interface
-	result = (*bqPlayerObject)->GetInterface(bqPlayerObject, SL_IID_EFFECTSEND,
-			&bqPlayerEffectSend);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject GetInterface SL_IID_EFFECTSEND failure.");
-		return -1;
-	}
+// every sample was decoded and the sink played all of it
+int audio_output_finished(Player *player) {
+	return player->audio_finished && (0 == player->output_count);
+}
 
-	// get the volume interface
-	result = (*bqPlayerObject)->GetInterface(bqPlayerObject, SL_IID_VOLUME,
-			&bqPlayerVolume);
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject GetInterface SL_IID_VOLUME failure.");
-		return -1;
+// the sink stops consuming, the clock interpolation must not count the pause
+void pauseAudioPlayer(Player *player, int pause) {
+	if (!player->audio_sink_opened) {
+		return;
 	}
 
-	// set the player's state to playing
-	result = (*bqPlayerPlay)->SetPlayState(bqPlayerPlay, SL_PLAYSTATE_PLAYING );
-	if (SL_RESULT_SUCCESS != result) {
-		LOGV2("bqPlayerObject SetPlayState SL_PLAYSTATE_PLAYING failure.");
-		return -1;
+	pthread_mutex_lock(&player->audio_clock_mutex);
+	if (pause) {
+		player->audio_pause_time = av_gettime_relative();
+	} else {
+		player->audio_played_time += av_gettime_relative()
+				- player->audio_pause_time;
 	}
+	pthread_mutex_unlock(&player->audio_clock_mutex);
 
-	LOGV2("OpenSL ES CreateAudioPlayer success.");
-
-	return 0;
+	player->audio_sink->pause(player, pause);
 }
 
-void fireOnPlayer() {
-	bqPlayerCallback(bqPlayerBufferQueue, NULL);
-}
+// fill every buffer so the sink never waits on a refill, without blocking
+// on the demuxer. Return 1 once the sink refills itself, 0 to try again and
+// -1 when audio ended without a buffer queued, no callback will come then.
+int fireOnPlayer(Player *player) {
+	int count, ret;
 
-/**
- * Destroys the given object instance.
- *
- * @param object object instance. [IN/OUT]
- */
-static void DestroyObject(SLObjectItf& object) {
-	if (0 != object)
-		(*object)->Destroy(object);
+	for (;;) {
+		pthread_mutex_lock(&player->audio_clock_mutex);
+		count = player->output_count;
+		pthread_mutex_unlock(&player->audio_clock_mutex);
+		if (count >= AUDIO_OUTPUT_BUFFERS) {
+			return 1;
+		}
 
-	object = 0;
+		ret = enqueue_audio_buffer(player, 0);
+		if (ret == 0) {
+			return 0;
+		} else if (ret < 0) {
+			// at the end or failed, the queued buffers still play out
+			return (count > 0) ? 1 : -1;
+		}
+	}
 }
 
-void destroyPlayerAndEngine() {
-	(*bqPlayerPlay)->SetPlayState(bqPlayerPlay, SL_PLAYSTATE_STOPPED );
+// the audio task, woken by the demux task until the sink is started
+int start_audio(void *opaque) {
+	Player *player = (Player*) opaque;
+	int ret;
 
-	// Destroy audio player object
-	DestroyObject(bqPlayerObject);
+	if (player->quit) {
+		return TASK_DONE;
+	}
 
-	// Destroy output mix object
-	DestroyObject(outputMixObject);
+	ret = fireOnPlayer(player);
+	if (ret > 0) {
+		player->audio_started = 1;
+		return TASK_DONE;
+	} else if (ret < 0) {
+		// nothing to start, audio_output_finished() holds already
+		return TASK_DONE;
+	}
 
-	// Destroy the engine instance
-	DestroyObject(engineObject);
+	// with packets left the sink callback holds the decoder, try again soon
+	return (player->audio_queue.nb_packets > 0) ? TASK_AGAIN : TASK_WAIT;
 }
-
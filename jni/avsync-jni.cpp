@@ -3,46 +3,339 @@
 
 #include "player.h"
 
+// the open methods start the player once the surface is set as well
+static jint start_when_ready(Player *player, int err) {
+	if ((err < 0) || (NULL == player->native_window)) {
+		return err;
+	}
+
+	return startPlayer(player);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeCreatePlayer
+ * Signature: ()J
+ */JNIEXPORT jlong JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeCreatePlayer(
+		JNIEnv *, jobject) {
+	Player *player = createPlayer(&opensl_audio_sink, &gl_video_sink);
+
+	if (player) {
+		player->notify = notifyVideoSurface;
+	}
+	return (jlong) (intptr_t) player;
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeDestroyPlayer
+ * Signature: (J)V
+ */JNIEXPORT void JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeDestroyPlayer(
+		JNIEnv *env, jobject, jlong handle) {
+	Player *player = (Player*) (intptr_t) handle;
+	jobject surface_object = player->surface_object;
+	jobject source_buffer = player->source_buffer;
+
+	destroyPlayer(player);
+
+	// notified and read until the player threads are gone
+	if (surface_object) {
+		env->DeleteGlobalRef(surface_object);
+	}
+	if (source_buffer) {
+		env->DeleteGlobalRef(source_buffer);
+	}
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeOpenPath
+ * Signature: (JLjava/lang/String;)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeOpenPath(
+		JNIEnv *env, jobject, jlong handle, jstring path) {
+	Player *player = (Player*) (intptr_t) handle;
+	const char *chars;
+	int err;
+
+	if (NULL == path) {
+		return -1;
+	}
+
+	chars = env->GetStringUTFChars(path, NULL);
+	if (NULL == chars) {
+		return -1;
+	}
+	err = openPath(player, chars);
+	env->ReleaseStringUTFChars(path, chars);
+
+	return start_when_ready(player, err);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeOpenFd
+ * Signature: (JIJJ)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeOpenFd(
+		JNIEnv *, jobject, jlong handle, jint fd, jlong offset,
+		jlong length) {
+	Player *player = (Player*) (intptr_t) handle;
+
+	return start_when_ready(player, openFd(player, fd, offset, length));
+}
+
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
- * Method:    setSurface
- * Signature: (Landroid/view/Surface;)I
- */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_setSurface(
-		JNIEnv *env, jobject obj, jobject surface) {
+ * Method:    nativeOpenBuffer
+ * Signature: (JLjava/nio/ByteBuffer;)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeOpenBuffer(
+		JNIEnv *env, jobject, jlong handle, jobject buffer) {
+	Player *player = (Player*) (intptr_t) handle;
+	uint8_t *data;
+	jlong size;
+	int err;
+
+	if ((NULL == buffer) || player->source_buffer) {
+		return -1;
+	}
+
+	// direct buffers only, a heap array may move
+	data = (uint8_t*) env->GetDirectBufferAddress(buffer);
+	size = env->GetDirectBufferCapacity(buffer);
+	if ((NULL == data) || (size <= 0)) {
+		LOGE("nativeOpenBuffer : not a direct buffer.");
+		return -1;
+	}
 
-	return setNativeSurface(env, obj, surface);
+	err = openBuffer(player, data, size);
+	if (err < 0) {
+		return err;
+	}
+
+	// keeps the memory alive for the demuxer
+	player->source_buffer = env->NewGlobalRef(buffer);
+	return start_when_ready(player, err);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetSurface
+ * Signature: (JLandroid/view/Surface;)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetSurface(
+		JNIEnv *env, jobject obj, jlong handle, jobject surface) {
+
+	return setNativeSurface((Player*) (intptr_t) handle, env, obj, surface);
 }
 
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
  * Method:    nativePausePlayer
- * Signature: ()I
+ * Signature: (J)I
  */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativePausePlayer(
-		JNIEnv *, jobject) {
-	global_context.pause = 1;
-	return 0;
+		JNIEnv *, jobject, jlong handle) {
+	Player *player = (Player*) (intptr_t) handle;
+
+	// the pause is the app's now, a new surface does not resume it
+	player->surface_paused = 0;
+	return pausePlayer(player);
 }
 
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
  * Method:    nativeResumePlayer
- * Signature: ()I
+ * Signature: (J)I
  */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeResumePlayer(
-		JNIEnv *, jobject) {
-	global_context.pause = 0;
-	return 0;
+		JNIEnv *, jobject, jlong handle) {
+	Player *player = (Player*) (intptr_t) handle;
+
+	player->surface_paused = 0;
+	return resumePlayer(player);
 }
 
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
  * Method:    nativeStopPlayer
- * Signature: ()I
+ * Signature: (J)I
  */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeStopPlayer(
-		JNIEnv *, jobject) {
-	global_context.pause = 1;
-	global_context.quit = 1;
-	eglClose();
-	destroyPlayerAndEngine();
-	usleep(50000);
+		JNIEnv *, jobject, jlong handle) {
+	Player *player = (Player*) (intptr_t) handle;
+
+	// returns once every thread of the player is done
+	stopPlayer(player);
 	return 0;
 }
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetPlaybackRate
+ * Signature: (JF)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetPlaybackRate(
+		JNIEnv *, jobject, jlong handle, jfloat rate) {
+	return setPlaybackRate((Player*) (intptr_t) handle, rate);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetSyncType
+ * Signature: (JI)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetSyncType(
+		JNIEnv *, jobject, jlong handle, jint sync_type) {
+	return setSyncType((Player*) (intptr_t) handle, sync_type);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetProbeOptions
+ * Signature: (JJJZ)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetProbeOptions(
+		JNIEnv *, jobject, jlong handle, jlong probesize,
+		jlong analyzeduration, jboolean fast_start) {
+	return setProbeOptions((Player*) (intptr_t) handle, probesize,
+			analyzeduration, fast_start);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetPrerollDuration
+ * Signature: (JI)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetPrerollDuration(
+		JNIEnv *, jobject, jlong handle, jint audio_ms) {
+	return setPrerollDuration((Player*) (intptr_t) handle, audio_ms);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetBufferingWatermarks
+ * Signature: (JII)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetBufferingWatermarks(
+		JNIEnv *, jobject, jlong handle, jint low_ms, jint high_ms) {
+	return setBufferingWatermarks((Player*) (intptr_t) handle, low_ms,
+			high_ms);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetReadAhead
+ * Signature: (JJF)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetReadAhead(
+		JNIEnv *, jobject, jlong handle, jlong bytes, jfloat seconds) {
+	return setReadAhead((Player*) (intptr_t) handle, bytes, seconds);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetPriority
+ * Signature: (JI)V
+ */JNIEXPORT void JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetPriority(
+		JNIEnv *, jobject, jlong handle, jint priority) {
+	setPlayerPriority((Player*) (intptr_t) handle, priority);
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeGetFrameDrops
+ * Signature: (J)[J
+ */JNIEXPORT jlongArray JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeGetFrameDrops(
+		JNIEnv *env, jobject, jlong handle) {
+	int64_t late, early;
+	jlong drops[2];
+	jlongArray result;
+
+	getFrameDrops((Player*) (intptr_t) handle, &late, &early);
+	drops[0] = late;
+	drops[1] = early;
+
+	result = env->NewLongArray(2);
+	if (NULL == result) {
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, 2, drops);
+	return result;
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeGetMetrics
+ * Signature: (J)[J
+ */JNIEXPORT jlongArray JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeGetMetrics(
+		JNIEnv *env, jobject, jlong handle) {
+	Metrics snapshot;
+	Histogram *h;
+	jlong values[METRIC_COUNTER_NB
+			+ HISTOGRAM_NB * (2 + 2 * HISTOGRAM_MAX_BUCKETS)];
+	jlongArray result;
+	int i, j, n = 0;
+
+	getMetrics((Player*) (intptr_t) handle, &snapshot);
+
+	// counters, then per histogram: buckets, bounds, counts and sum
+	for (i = 0; i < METRIC_COUNTER_NB; i++) {
+		values[n++] = snapshot.counters[i];
+	}
+	for (i = 0; i < HISTOGRAM_NB; i++) {
+		h = &snapshot.histograms[i];
+		values[n++] = h->nb_buckets;
+		for (j = 0; j < h->nb_buckets - 1; j++) {
+			values[n++] = h->bounds[j];
+		}
+		for (j = 0; j < h->nb_buckets; j++) {
+			values[n++] = h->counts[j];
+		}
+		values[n++] = h->sum;
+	}
+
+	result = env->NewLongArray(n);
+	if (NULL == result) {
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, n, values);
+	return result;
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeDumpTrace
+ * Signature: ()Ljava/lang/String;
+ */JNIEXPORT jstring JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeDumpTrace(
+		JNIEnv *env, jobject) {
+	char *json = trace_dump();
+	jstring result;
+
+	if (NULL == json) {
+		return NULL;
+	}
+
+	result = env->NewStringUTF(json);
+	av_free(json);
+	return result;
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetStreamCache
+ * Signature: (Ljava/lang/String;J)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetStreamCache(
+		JNIEnv *env, jobject, jstring dir, jlong max_bytes) {
+	const char *chars;
+	int err;
+
+	if (NULL == dir) {
+		return setStreamCache(NULL, 0);
+	}
+
+	chars = env->GetStringUTFChars(dir, NULL);
+	if (NULL == chars) {
+		return -1;
+	}
+	err = setStreamCache(chars, max_bytes);
+	env->ReleaseStringUTFChars(dir, chars);
+	return err;
+}
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetLogLevel
+ * Signature: (II)I
+ */JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetLogLevel(
+		JNIEnv *, jobject, jint category, jint level) {
+	return setLogLevel(category, level);
+}
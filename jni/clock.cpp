@@ -0,0 +1,82 @@
+#include "player.h"
+
+static double clock_time() {
+	return av_gettime_relative() / 1000000.0;
+}
+
+double get_clock(Clock *c) {
+	double time;
+
+	if (c->paused) {
+		return c->pts;
+	}
+
+	// the clock follows its source, e.g. the audio sink position
+	if (NULL != c->get_source) {
+		return c->get_source(c->opaque);
+	}
+
+	if (*c->queue_serial != c->serial) {
+		return NAN;
+	}
+
+	time = clock_time();
+	return c->pts_drift + time - (time - c->last_updated) * (1.0 - c->speed);
+}
+
+void set_clock_at(Clock *c, double pts, int serial, double time) {
+	c->pts = pts;
+	c->last_updated = time;
+	c->pts_drift = c->pts - time;
+	c->serial = serial;
+}
+
+void set_clock(Clock *c, double pts, int serial) {
+	set_clock_at(c, pts, serial, clock_time());
+}
+
+void set_clock_speed(Clock *c, double speed) {
+	set_clock(c, get_clock(c), c->serial);
+	c->speed = speed;
+}
+
+// a paused clock keeps its pts, it runs on from there when resumed
+void set_clock_paused(Clock *c, int paused) {
+	if (NULL == c->queue_serial) {
+		// not initialized yet, nothing is playing
+		return;
+	}
+
+	if (paused) {
+		set_clock(c, get_clock(c), c->serial);
+	} else {
+		set_clock(c, c->pts, c->serial);
+	}
+	c->paused = paused;
+}
+
+void init_clock(Clock *c, int *queue_serial) {
+	c->speed = 1.0;
+	c->paused = 0;
+	c->queue_serial = queue_serial;
+	c->get_source = NULL;
+	c->opaque = NULL;
+	set_clock(c, NAN, -1);
+}
+
+void set_clock_source(Clock *c, double (*get_source)(void *opaque),
+		void *opaque) {
+	c->get_source = get_source;
+	c->opaque = opaque;
+}
+
+// keep c close to slave, so switching to c as master does not jump
+void sync_clock_to_slave(Clock *c, Clock *slave) {
+	double clock = get_clock(c);
+	double slave_clock = get_clock(slave);
+
+	if (!isnan(slave_clock)
+			&& (isnan(clock) || fabs(clock - slave_clock) > AV_NOSYNC_THRESHOLD)) {
+		set_clock(c, slave_clock, slave->serial);
+	}
+}
@@ -157,38 +157,186 @@ extern "C" {
 #define com_ffmpeg_avsync_VideoSurface_LAYER_TYPE_SOFTWARE 1L
 #undef com_ffmpeg_avsync_VideoSurface_LAYER_TYPE_HARDWARE
 #define com_ffmpeg_avsync_VideoSurface_LAYER_TYPE_HARDWARE 2L
+#undef com_ffmpeg_avsync_VideoSurface_SYNC_AUDIO_MASTER
+#define com_ffmpeg_avsync_VideoSurface_SYNC_AUDIO_MASTER 0L
+#undef com_ffmpeg_avsync_VideoSurface_SYNC_VIDEO_MASTER
+#define com_ffmpeg_avsync_VideoSurface_SYNC_VIDEO_MASTER 1L
+#undef com_ffmpeg_avsync_VideoSurface_SYNC_EXTERNAL_MASTER
+#define com_ffmpeg_avsync_VideoSurface_SYNC_EXTERNAL_MASTER 2L
+#undef com_ffmpeg_avsync_VideoSurface_LOG_CATEGORY_PLAYER
+#define com_ffmpeg_avsync_VideoSurface_LOG_CATEGORY_PLAYER 0L
+#undef com_ffmpeg_avsync_VideoSurface_LOG_CATEGORY_VIDEO
+#define com_ffmpeg_avsync_VideoSurface_LOG_CATEGORY_VIDEO 1L
+#undef com_ffmpeg_avsync_VideoSurface_LOG_CATEGORY_AUDIO
+#define com_ffmpeg_avsync_VideoSurface_LOG_CATEGORY_AUDIO 2L
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
- * Method:    setSurface
- * Signature: (Landroid/view/Surface;)I
+ * Method:    nativeCreatePlayer
+ * Signature: ()J
  */
-JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_setSurface
-  (JNIEnv *, jobject, jobject);
+JNIEXPORT jlong JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeCreatePlayer
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeDestroyPlayer
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeDestroyPlayer
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeOpenPath
+ * Signature: (JLjava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeOpenPath
+  (JNIEnv *, jobject, jlong, jstring);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeOpenFd
+ * Signature: (JIJJ)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeOpenFd
+  (JNIEnv *, jobject, jlong, jint, jlong, jlong);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeOpenBuffer
+ * Signature: (JLjava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeOpenBuffer
+  (JNIEnv *, jobject, jlong, jobject);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetSurface
+ * Signature: (JLandroid/view/Surface;)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetSurface
+  (JNIEnv *, jobject, jlong, jobject);
 
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
  * Method:    nativePausePlayer
- * Signature: ()I
+ * Signature: (J)I
  */
 JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativePausePlayer
-  (JNIEnv *, jobject);
+  (JNIEnv *, jobject, jlong);
 
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
  * Method:    nativeResumePlayer
- * Signature: ()I
+ * Signature: (J)I
  */
 JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeResumePlayer
-  (JNIEnv *, jobject);
+  (JNIEnv *, jobject, jlong);
 
 /*
  * Class:     com_ffmpeg_avsync_VideoSurface
  * Method:    nativeStopPlayer
- * Signature: ()I
+ * Signature: (J)I
  */
 JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeStopPlayer
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetPlaybackRate
+ * Signature: (JF)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetPlaybackRate
+  (JNIEnv *, jobject, jlong, jfloat);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetSyncType
+ * Signature: (JI)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetSyncType
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetProbeOptions
+ * Signature: (JJJZ)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetProbeOptions
+  (JNIEnv *, jobject, jlong, jlong, jlong, jboolean);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetPrerollDuration
+ * Signature: (JI)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetPrerollDuration
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetBufferingWatermarks
+ * Signature: (JII)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetBufferingWatermarks
+  (JNIEnv *, jobject, jlong, jint, jint);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetReadAhead
+ * Signature: (JJF)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetReadAhead
+  (JNIEnv *, jobject, jlong, jlong, jfloat);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetPriority
+ * Signature: (JI)V
+ */
+JNIEXPORT void JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetPriority
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeGetFrameDrops
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeGetFrameDrops
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeGetMetrics
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeGetMetrics
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeDumpTrace
+ * Signature: ()Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeDumpTrace
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetStreamCache
+ * Signature: (Ljava/lang/String;J)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetStreamCache
+  (JNIEnv *, jobject, jstring, jlong);
+
+/*
+ * Class:     com_ffmpeg_avsync_VideoSurface
+ * Method:    nativeSetLogLevel
+ * Signature: (II)I
+ */
+JNIEXPORT jint JNICALL Java_com_ffmpeg_avsync_VideoSurface_nativeSetLogLevel
+  (JNIEnv *, jobject, jint, jint);
+
 #ifdef __cplusplus
 }
 #endif
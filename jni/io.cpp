@@ -0,0 +1,721 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "player.h"
+
+/*
+ * Local files, and file descriptors handed in by the app, are read through
+ * a memory map instead of the file protocol, so the kernel reads ahead in
+ * large requests rather than one small read() per avio buffer. Files bigger
+ * than a window are mapped a window at a time, moved as the demuxer goes.
+ *
+ * The demuxer does not touch the map itself: a thread per player copies
+ * blocks from it into a ring ahead of the demuxer, so page faults and slow
+ * storage stall that thread and the demuxer reads from memory. Pipes go
+ * through the same ring, buffers of the app are read in place.
+ */
+
+/* bytes mapped at a time */
+#define IO_MAP_WINDOW (32 * 1024 * 1024)
+/* buffer of the AVIOContext */
+#define IO_BUFFER_SIZE (256 * 1024)
+/* bytes the read-ahead thread reads at once */
+#define IO_BLOCK_SIZE (256 * 1024)
+
+// the media is size bytes of fd from start, e.g. an asset in an apk
+typedef struct MappedFile {
+	int fd;
+	int64_t start;
+	int64_t size;
+	int64_t pos;                   // next byte the demuxer reads
+	uint8_t *window;               // NULL until the first read
+	int64_t window_pos;            // file offset of window, page aligned
+	size_t window_size;
+} MappedFile;
+
+// read past what mmap can reach with a 32 bit off_t, e.g. on armv7 android
+static int mapped_pread(MappedFile *f, uint8_t *buf, int buf_size) {
+	int64_t offset = f->start + f->pos;
+	size_t size = (size_t) FFMIN((int64_t) buf_size, f->size - f->pos);
+	ssize_t ret;
+
+	do {
+		ret = pread64(f->fd, buf, size, (off64_t) offset);
+	} while ((ret < 0) && (EINTR == errno));
+	if (ret < 0) {
+		av_log(NULL, AV_LOG_ERROR, "mapped_pread : pread failure, %s. \n",
+				strerror(errno));
+		return AVERROR(errno);
+	} else if (0 == ret) {
+		return AVERROR_EOF;
+	}
+
+	f->pos += ret;
+	return (int) ret;
+}
+
+// map the window holding pos, the previous one is dropped
+static int map_window(MappedFile *f) {
+	long page = sysconf(_SC_PAGESIZE);
+	int64_t offset = f->start + f->pos;
+	int64_t window_pos = offset - offset % page;
+	size_t window_size = (size_t) FFMIN((int64_t) IO_MAP_WINDOW,
+			f->start + f->size - window_pos);
+	void *window;
+
+	if (f->window) {
+		munmap(f->window, f->window_size);
+		f->window = NULL;
+	}
+
+	TRACE_BEGIN("io_map");
+	window = mmap(NULL, window_size, PROT_READ, MAP_PRIVATE, f->fd,
+			(off_t) window_pos);
+	TRACE_END("io_map");
+	if (MAP_FAILED == window) {
+		av_log(NULL, AV_LOG_ERROR, "map_window : mmap failure, %s. \n",
+				strerror(errno));
+		return AVERROR(errno);
+	}
+
+	// the kernel reads ahead further and drops pages behind us sooner
+	madvise(window, window_size, MADV_SEQUENTIAL);
+
+	f->window = (uint8_t*) window;
+	f->window_pos = window_pos;
+	f->window_size = window_size;
+	return 0;
+}
+
+static int mapped_read(void *opaque, uint8_t *buf, int buf_size) {
+	MappedFile *f = (MappedFile*) opaque;
+	int64_t offset = f->start + f->pos;
+	int size, err;
+
+	if (f->pos >= f->size) {
+		return AVERROR_EOF;
+	}
+
+	if ((NULL == f->window) || (offset < f->window_pos)
+			|| (offset >= f->window_pos + (int64_t) f->window_size)) {
+		if ((int64_t) (off_t) offset != offset) {
+			return mapped_pread(f, buf, buf_size);
+		}
+		if ((err = map_window(f)) < 0) {
+			return err;
+		}
+	}
+
+	offset -= f->window_pos;
+	size = (int) FFMIN((int64_t) buf_size, (int64_t) f->window_size - offset);
+	memcpy(buf, f->window + offset, size);
+	f->pos += size;
+
+	return size;
+}
+
+static int64_t mapped_seek(void *opaque, int64_t offset, int whence) {
+	MappedFile *f = (MappedFile*) opaque;
+	int64_t pos;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return f->size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = f->pos + offset;
+		break;
+	case SEEK_END:
+		pos = f->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	// the window moves on the next read, if it has to
+	f->pos = pos;
+	return pos;
+}
+
+static void mapped_close(void *opaque) {
+	MappedFile *f = (MappedFile*) opaque;
+
+	if (f->window) {
+		munmap(f->window, f->window_size);
+	}
+	close(f->fd);
+	av_free(f);
+}
+
+// a pipe or socket, e.g. from a content provider, can not be mapped or
+// seeked, the ring is all the read ahead it gets
+typedef struct PipeFile {
+	int fd;
+	int64_t pos;
+} PipeFile;
+
+static int pipe_read(void *opaque, uint8_t *buf, int buf_size) {
+	PipeFile *f = (PipeFile*) opaque;
+	ssize_t size;
+
+	do {
+		size = read(f->fd, buf, buf_size);
+	} while ((size < 0) && (EINTR == errno));
+
+	if (size < 0) {
+		return AVERROR(errno);
+	}
+	if (0 == size) {
+		return AVERROR_EOF;
+	}
+
+	f->pos += size;
+	return (int) size;
+}
+
+static int64_t pipe_seek(void *opaque, int64_t offset, int whence) {
+	PipeFile *f = (PipeFile*) opaque;
+
+	if (AVSEEK_SIZE == (whence & ~AVSEEK_FORCE)) {
+		return -1;
+	}
+
+	// only the position it is at already
+	if ((SEEK_SET == (whence & ~AVSEEK_FORCE)) && (offset == f->pos)) {
+		return f->pos;
+	}
+
+	return AVERROR(ESPIPE);
+}
+
+static void pipe_close(void *opaque) {
+	PipeFile *f = (PipeFile*) opaque;
+
+	close(f->fd);
+	av_free(f);
+}
+
+// media the app holds in memory, read in place
+typedef struct MemoryBuffer {
+	const uint8_t *data;
+	int64_t size;
+	int64_t pos;
+} MemoryBuffer;
+
+static int memory_read(void *opaque, uint8_t *buf, int buf_size) {
+	MemoryBuffer *m = (MemoryBuffer*) opaque;
+	int size = (int) FFMIN((int64_t) buf_size, m->size - m->pos);
+
+	if (size <= 0) {
+		return AVERROR_EOF;
+	}
+
+	memcpy(buf, m->data + m->pos, size);
+	m->pos += size;
+	return size;
+}
+
+static int64_t memory_seek(void *opaque, int64_t offset, int whence) {
+	MemoryBuffer *m = (MemoryBuffer*) opaque;
+	int64_t pos;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return m->size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = m->pos + offset;
+		break;
+	case SEEK_END:
+		pos = m->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if ((pos < 0) || (pos > m->size)) {
+		return AVERROR(EINVAL);
+	}
+
+	m->pos = pos;
+	return pos;
+}
+
+static void memory_close(void *opaque) {
+	av_free(opaque);
+}
+
+/*
+ * The ring holds the source bytes [pos, pos + filled), starting at rindex.
+ * The thread reads into the free space after them, the demuxer consumes
+ * from rindex. A seek out of the ring drops it, generation tells the thread
+ * that the block it was reading meanwhile is stale.
+ */
+typedef struct ReadAhead {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;           // data read, space freed, seek or abort
+
+	// where the bytes come from, the AVIOContext callbacks of the source
+	int (*read)(void *opaque, uint8_t *buf, int size);
+	int64_t (*seek)(void *opaque, int64_t offset, int whence);
+	void *opaque;
+	int64_t size;                  // of the source, < 0 if unknown
+
+	uint8_t *ring;
+	int ring_size;                 // bytes allocated
+	int limit;                     // bytes read ahead at most
+	int rindex;
+	int filled;
+	int64_t pos;                   // source offset of rindex
+	int64_t seek_pos;              // the thread moves the source here, or -1
+	int generation;
+	int eof;
+	int error;
+	int abort;
+} ReadAhead;
+
+static void *read_ahead_thread(void *argv) {
+	ReadAhead *ra = (ReadAhead*) argv;
+	int64_t seek_pos;
+	int generation, windex, len, ret;
+
+	TRACE_THREAD("read_ahead");
+
+	pthread_mutex_lock(&ra->mutex);
+	for (;;) {
+		while (!ra->abort && (ra->seek_pos < 0)
+				&& (ra->eof || ra->error
+						|| (ra->limit - ra->filled < IO_BLOCK_SIZE))) {
+			pthread_cond_wait(&ra->cond, &ra->mutex);
+		}
+
+		if (ra->abort) {
+			break;
+		}
+
+		generation = ra->generation;
+		if (ra->seek_pos >= 0) {
+			seek_pos = ra->seek_pos;
+			ra->seek_pos = -1;
+			pthread_mutex_unlock(&ra->mutex);
+
+			TRACE_BEGIN("io_seek");
+			ret = (int) FFMIN(ra->seek(ra->opaque, seek_pos, SEEK_SET), 0);
+			TRACE_END("io_seek");
+
+			pthread_mutex_lock(&ra->mutex);
+			if ((generation == ra->generation) && (ret < 0)) {
+				ra->error = ret;
+				pthread_cond_broadcast(&ra->cond);
+			}
+			continue;
+		}
+
+		// up to the end of the ring, the demuxer reads the bytes before it
+		windex = (ra->rindex + ra->filled) % ra->ring_size;
+		len = FFMIN(IO_BLOCK_SIZE, ra->ring_size - windex);
+		len = FFMIN(len, ra->limit - ra->filled);
+		pthread_mutex_unlock(&ra->mutex);
+
+		TRACE_BEGIN("io_read");
+		ret = ra->read(ra->opaque, ra->ring + windex, len);
+		TRACE_END("io_read");
+
+		pthread_mutex_lock(&ra->mutex);
+		if (generation != ra->generation) {
+			continue;
+		}
+
+		if (ret > 0) {
+			ra->filled += ret;
+		} else if ((0 == ret) || (AVERROR_EOF == ret)) {
+			ra->eof = 1;
+		} else {
+			ra->error = ret;
+		}
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+
+	return NULL;
+}
+
+// the demuxer side, it only waits when the thread fell behind
+static int read_ahead_read(void *opaque, uint8_t *buf, int buf_size) {
+	ReadAhead *ra = (ReadAhead*) opaque;
+	int size;
+
+	pthread_mutex_lock(&ra->mutex);
+	while (!ra->abort && (0 == ra->filled) && !ra->eof && !ra->error) {
+		pthread_cond_wait(&ra->cond, &ra->mutex);
+	}
+
+	if (ra->abort) {
+		size = AVERROR_EXIT;
+	} else if (0 == ra->filled) {
+		size = ra->error ? ra->error : AVERROR_EOF;
+	} else {
+		size = FFMIN(buf_size, ra->filled);
+		size = FFMIN(size, ra->ring_size - ra->rindex);
+		memcpy(buf, ra->ring + ra->rindex, size);
+
+		ra->rindex = (ra->rindex + size) % ra->ring_size;
+		ra->filled -= size;
+		ra->pos += size;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+
+	return size;
+}
+
+static int64_t read_ahead_seek(void *opaque, int64_t offset, int whence) {
+	ReadAhead *ra = (ReadAhead*) opaque;
+	int64_t pos;
+	int skip;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return ra->size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = ra->pos + offset;
+		break;
+	case SEEK_END:
+		if (ra->size < 0) {
+			return AVERROR(ENOSYS);
+		}
+		pos = ra->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	pthread_mutex_lock(&ra->mutex);
+	if ((pos >= ra->pos) && (pos <= ra->pos + ra->filled)) {
+		// short skips forward, e.g. over a packet, stay in the ring
+		skip = (int) (pos - ra->pos);
+		ra->rindex = (ra->rindex + skip) % ra->ring_size;
+		ra->filled -= skip;
+	} else {
+		ra->seek_pos = pos;
+		ra->generation++;
+		ra->rindex = 0;
+		ra->filled = 0;
+		ra->eof = 0;
+		ra->error = 0;
+	}
+	ra->pos = pos;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+
+	return pos;
+}
+
+static void read_ahead_free(ReadAhead *ra) {
+	pthread_mutex_destroy(&ra->mutex);
+	pthread_cond_destroy(&ra->cond);
+	av_free(ra->ring);
+	av_free(ra);
+}
+
+// bytes is the ring size, at least two blocks
+static ReadAhead *read_ahead_start(int (*read)(void*, uint8_t*, int),
+		int64_t (*seek)(void*, int64_t, int), void *opaque, int64_t bytes) {
+	ReadAhead *ra = (ReadAhead*) av_mallocz(sizeof(ReadAhead));
+
+	if (NULL == ra) {
+		return NULL;
+	}
+
+	ra->read = read;
+	ra->seek = seek;
+	ra->opaque = opaque;
+	ra->size = seek(opaque, 0, AVSEEK_SIZE);
+	ra->ring_size = (int) FFMAX(bytes, 2 * IO_BLOCK_SIZE);
+	ra->limit = ra->ring_size;
+	ra->seek_pos = -1;
+	pthread_mutex_init(&ra->mutex, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+
+	ra->ring = (uint8_t*) av_malloc(ra->ring_size);
+	if (NULL == ra->ring) {
+		read_ahead_free(ra);
+		return NULL;
+	}
+
+	if (pthread_create(&ra->thread, NULL, read_ahead_thread, ra) != 0) {
+		av_log(NULL, AV_LOG_ERROR,
+				"read_ahead_start : pthread_create failure. \n");
+		read_ahead_free(ra);
+		return NULL;
+	}
+
+	return ra;
+}
+
+// wake the demuxer waiting for data, reads fail from now on
+static void read_ahead_abort(ReadAhead *ra) {
+	pthread_mutex_lock(&ra->mutex);
+	ra->abort = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+}
+
+static void read_ahead_stop(ReadAhead *ra) {
+	read_ahead_abort(ra);
+	pthread_join(ra->thread, NULL);
+	read_ahead_free(ra);
+}
+
+// Player.io_priv, the source and the ring in front of it
+typedef struct MediaIO {
+	void *source;
+	void (*close)(void *source);
+	ReadAhead *read_ahead;         // NULL for sources in memory
+} MediaIO;
+
+// before startPlayer(), bytes caps the ring, seconds > 0 limits the read
+// ahead to that much of the media once its bitrate is known
+int setReadAhead(Player *player, int64_t bytes, double seconds) {
+	if ((bytes < 2 * IO_BLOCK_SIZE) || (bytes > INT_MAX) || (seconds < 0)) {
+		av_log(NULL, AV_LOG_ERROR, "setReadAhead : out of range. \n");
+		return -1;
+	}
+
+	player->read_ahead_bytes = bytes;
+	player->read_ahead_seconds = seconds;
+	return 0;
+}
+
+// the media is probed, size the read ahead in seconds if asked to
+void media_io_set_bitrate(Player *player, int64_t bit_rate) {
+	MediaIO *io = (MediaIO*) player->io_priv;
+	ReadAhead *ra = io ? io->read_ahead : NULL;
+	int64_t limit;
+
+	if ((NULL == ra) || (player->read_ahead_seconds <= 0) || (bit_rate <= 0)) {
+		return;
+	}
+
+	limit = (int64_t) (player->read_ahead_seconds * bit_rate / 8);
+	limit = av_clip64(limit, 2 * IO_BLOCK_SIZE, ra->ring_size);
+
+	pthread_mutex_lock(&ra->mutex);
+	ra->limit = (int) limit;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+
+	LOGV("media_io_set_bitrate : read ahead %" PRId64 " bytes.", limit);
+}
+
+// plain paths and file: urls, everything else goes to its protocol
+static const char *local_path(const char *url) {
+	if (!strncmp(url, "file:", 5)) {
+		return url + 5;
+	}
+
+	return strstr(url, "://") ? NULL : url;
+}
+
+// a MappedFile or a PipeFile on fd, which is closed on failure
+static int open_fd_source(MediaIO *io, int fd, int64_t offset,
+		int64_t length) {
+	MappedFile *f;
+	PipeFile *p;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return AVERROR(errno);
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		p = (PipeFile*) av_mallocz(sizeof(PipeFile));
+		if (NULL == p) {
+			close(fd);
+			return AVERROR(ENOMEM);
+		}
+		p->fd = fd;
+
+		io->source = p;
+		io->close = pipe_close;
+		return 0;
+	}
+
+	if ((offset > st.st_size) || (offset < 0)) {
+		av_log(NULL, AV_LOG_ERROR, "open_fd_source : offset past the end. \n");
+		close(fd);
+		return AVERROR(EINVAL);
+	}
+	if ((length < 0) || (offset + length > st.st_size)) {
+		length = st.st_size - offset;
+	}
+	if (0 == length) {
+		close(fd);
+		return AVERROR_INVALIDDATA;
+	}
+
+	f = (MappedFile*) av_mallocz(sizeof(MappedFile));
+	if (NULL == f) {
+		close(fd);
+		return AVERROR(ENOMEM);
+	}
+	f->fd = fd;
+	f->start = offset;
+	f->size = length;
+
+	io->source = f;
+	io->close = mapped_close;
+	return 0;
+}
+
+static void media_io_free(MediaIO *io) {
+	if (io->read_ahead) {
+		read_ahead_stop(io->read_ahead);
+	}
+	if (io->source) {
+		io->close(io->source);
+	}
+	av_free(io);
+}
+
+// Give fmt_ctx our own input for player->source, 1 leaves a url to the
+// avformat protocols.
+int open_media_io(Player *player, AVFormatContext *fmt_ctx) {
+	MediaSource *src = &player->source;
+	const char *path;
+	MemoryBuffer *m;
+	MediaIO *io;
+	uint8_t *buffer;
+	int fd, err = 0;
+
+	io = (MediaIO*) av_mallocz(sizeof(MediaIO));
+	if (NULL == io) {
+		return AVERROR(ENOMEM);
+	}
+
+	switch (src->type) {
+	case SOURCE_PATH:
+		if (stream_url(src->path)) {
+			err = open_stream(player, src->path, NULL, &io->source);
+			io->close = stream_close;
+			break;
+		}
+
+		path = local_path(src->path);
+		fd = path ? open(path, O_RDONLY) : -1;
+		if (fd < 0) {
+			av_free(io);
+			return 1;
+		}
+		err = open_fd_source(io, fd, 0, -1);
+		break;
+	case SOURCE_FD:
+		// ours to close, the app may close its own as soon as we return
+		fd = dup(src->fd);
+		err = (fd < 0) ? AVERROR(errno)
+				: open_fd_source(io, fd, src->offset, src->length);
+		break;
+	case SOURCE_BUFFER:
+		m = (MemoryBuffer*) av_mallocz(sizeof(MemoryBuffer));
+		if (NULL == m) {
+			err = AVERROR(ENOMEM);
+			break;
+		}
+		m->data = src->data;
+		m->size = src->length;
+		io->source = m;
+		io->close = memory_close;
+		break;
+	default:
+		err = AVERROR(EINVAL);
+		break;
+	}
+
+	if (err < 0) {
+		av_log(NULL, AV_LOG_ERROR, "open_media_io : source %d failure. \n",
+				src->type);
+		av_free(io);
+		return err;
+	}
+
+	buffer = (uint8_t*) av_malloc(IO_BUFFER_SIZE);
+	if (NULL == buffer) {
+		media_io_free(io);
+		return AVERROR(ENOMEM);
+	}
+
+	if (io->close == memory_close) {
+		player->io_ctx = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0,
+				io->source, memory_read, NULL, memory_seek);
+	} else if (io->close == mapped_close) {
+		io->read_ahead = read_ahead_start(mapped_read, mapped_seek,
+				io->source, player->read_ahead_bytes);
+	} else if (io->close == stream_close) {
+		io->read_ahead = read_ahead_start(stream_read, stream_seek,
+				io->source, player->read_ahead_bytes);
+	} else {
+		io->read_ahead = read_ahead_start(pipe_read, pipe_seek, io->source,
+				player->read_ahead_bytes);
+	}
+	if (io->read_ahead) {
+		player->io_ctx = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0,
+				io->read_ahead, read_ahead_read, NULL, read_ahead_seek);
+	}
+
+	if (NULL == player->io_ctx) {
+		av_free(buffer);
+		media_io_free(io);
+		return AVERROR(ENOMEM);
+	}
+	player->io_priv = io;
+
+	fmt_ctx->pb = player->io_ctx;
+	fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	LOGV("open_media_io : source %d, %s.", src->type,
+			io->read_ahead ? "read ahead" : "in memory");
+	return 0;
+}
+
+// stopPlayer() must not wait for a demuxer blocked on the read ahead
+void abort_media_io(Player *player) {
+	MediaIO *io = (MediaIO*) player->io_priv;
+
+	if (io && io->read_ahead) {
+		read_ahead_abort(io->read_ahead);
+	}
+	stream_abort(player);
+}
+
+// after avformat_close_input(), which leaves a custom AVIOContext alone
+void close_media_io(Player *player) {
+	if (player->io_ctx) {
+		av_freep(&player->io_ctx->buffer);
+		av_freep(&player->io_ctx);
+	}
+
+	if (player->io_priv) {
+		media_io_free((MediaIO*) player->io_priv);
+		player->io_priv = NULL;
+	}
+
+	// the read ahead thread may have started it
+	stream_stop(player);
+}
@@ -0,0 +1,97 @@
+#include "player.h"
+
+/*
+ * Fixed bucket histograms, a value goes to the first bucket whose upper
+ * bound is above it, the last bucket takes everything else.
+ */
+
+// a/v difference of a shown picture, ms
+static const int64_t av_diff_bounds[] = { -200, -100, -50, -20, -10, 10, 20,
+		50, 100, 200 };
+// packets in a packet queue
+static const int64_t packet_queue_bounds[] = { 1, 2, 5, 10, 20, 50, 100, 200,
+		500 };
+// pictures in the picture queue
+static const int64_t picture_queue_bounds[] = { 1, 2, 4, 8, 16, 24 };
+// time to decode one video frame, us
+static const int64_t decode_time_bounds[] = { 1000, 2000, 4000, 8000, 16000,
+		33000, 66000, 133000 };
+
+static void init_histogram(Histogram *h, const int64_t *bounds, int nb_bounds) {
+	memset(h, 0, sizeof(Histogram));
+	h->nb_buckets = nb_bounds + 1;
+	memcpy(h->bounds, bounds, nb_bounds * sizeof(int64_t));
+}
+
+void metrics_reset(Metrics *m) {
+	memset(m->counters, 0, sizeof(m->counters));
+
+	init_histogram(&m->histograms[HISTOGRAM_AV_DIFF], av_diff_bounds,
+			FF_ARRAY_ELEMS(av_diff_bounds));
+	init_histogram(&m->histograms[HISTOGRAM_VIDEO_QUEUE], packet_queue_bounds,
+			FF_ARRAY_ELEMS(packet_queue_bounds));
+	init_histogram(&m->histograms[HISTOGRAM_AUDIO_QUEUE], packet_queue_bounds,
+			FF_ARRAY_ELEMS(packet_queue_bounds));
+	init_histogram(&m->histograms[HISTOGRAM_PICTURE_QUEUE],
+			picture_queue_bounds, FF_ARRAY_ELEMS(picture_queue_bounds));
+	init_histogram(&m->histograms[HISTOGRAM_DECODE_TIME], decode_time_bounds,
+			FF_ARRAY_ELEMS(decode_time_bounds));
+}
+
+// counters are bumped from several threads, keep them lock free
+void metrics_count(Metrics *m, int counter) {
+	__sync_fetch_and_add(&m->counters[counter], 1);
+}
+
+// for the counters that hold a time
+void metrics_set(Metrics *m, int counter, int64_t value) {
+	__sync_lock_test_and_set(&m->counters[counter], value);
+}
+
+// for the counters that sum times
+void metrics_add(Metrics *m, int counter, int64_t value) {
+	__sync_fetch_and_add(&m->counters[counter], value);
+}
+
+void metrics_record(Metrics *m, int histogram, int64_t value) {
+	Histogram *h = &m->histograms[histogram];
+	int i;
+
+	for (i = 0; i < h->nb_buckets - 1; i++) {
+		if (value < h->bounds[i]) {
+			break;
+		}
+	}
+
+	__sync_fetch_and_add(&h->counts[i], 1);
+	__sync_fetch_and_add(&h->sum, value);
+}
+
+// a 64 bit value is not read in one go on 32 bit arm, so every value is
+// read atomically. Values bumped during the copy may or may not be in it,
+// a histogram sum can be one record ahead of or behind its counts.
+static int64_t metrics_read(int64_t *value) {
+	return __sync_fetch_and_add(value, 0);
+}
+
+void metrics_snapshot(Metrics *m, Metrics *snapshot) {
+	Histogram *h, *s;
+	int i, j;
+
+	for (i = 0; i < METRIC_COUNTER_NB; i++) {
+		snapshot->counters[i] = metrics_read(&m->counters[i]);
+	}
+
+	for (i = 0; i < HISTOGRAM_NB; i++) {
+		h = &m->histograms[i];
+		s = &snapshot->histograms[i];
+
+		// the layout is set by metrics_reset() and does not change
+		s->nb_buckets = h->nb_buckets;
+		memcpy(s->bounds, h->bounds, sizeof(s->bounds));
+		for (j = 0; j < HISTOGRAM_MAX_BUCKETS; j++) {
+			s->counts[j] = metrics_read(&h->counts[j]);
+		}
+		s->sum = metrics_read(&h->sum);
+	}
+}
@@ -0,0 +1,339 @@
+#include "player.h"
+
+// for native audio
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+
+// engine interfaces, one engine serves every player of the process
+static SLObjectItf engineObject = NULL;
+static SLEngineItf engineEngine;
+static int engineRefs;
+static pthread_mutex_t engineMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// output mix interfaces
+static SLObjectItf outputMixObject = NULL;
+static SLEnvironmentalReverbItf outputMixEnvironmentalReverb = NULL;
+
+// buffer queue player interfaces, in player->audio_sink_priv
+typedef struct OpenSLPlayer {
+	SLObjectItf bqPlayerObject;
+	SLPlayItf bqPlayerPlay;
+	SLAndroidSimpleBufferQueueItf bqPlayerBufferQueue;
+	SLEffectSendItf bqPlayerEffectSend;
+	SLVolumeItf bqPlayerVolume;
+} OpenSLPlayer;
+
+// this callback handler is called every time a buffer finishes playing
+void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context) {
+	Player *player = (Player*) context;
+	OpenSLPlayer *sl = (OpenSLPlayer*) player->audio_sink_priv;
+
+	//LOGV2("bqPlayerCallback...");
+
+	if (bq != sl->bqPlayerBufferQueue) {
+		LOGE2("bqPlayerCallback : not the same player object.");
+		return;
+	}
+
+	audio_sink_callback(player);
+}
+
+static int createEngine() {
+
+	SLresult result;
+
+	// create engine
+	result = slCreateEngine(&engineObject, 0, NULL, 0, NULL, NULL);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("slCreateEngine failure.");
+		return -1;
+	}
+
+	// realize the engine
+	result = (*engineObject)->Realize(engineObject, SL_BOOLEAN_FALSE );
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("engineObject Realize failure.");
+		(*engineObject)->Destroy(engineObject);
+		engineObject = NULL;
+		engineEngine = NULL;
+		return -1;
+	}
+
+	// get the engine interface, which is needed in order to create other objects
+	result = (*engineObject)->GetInterface(engineObject, SL_IID_ENGINE,
+			&engineEngine);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("engineObject GetInterface failure.");
+		(*engineObject)->Destroy(engineObject);
+		engineObject = NULL;
+		engineEngine = NULL;
+		return -1;
+	}
+
+	// create output mix, with environmental reverb specified as a non-required interface
+	const SLInterfaceID ids[1] = { SL_IID_ENVIRONMENTALREVERB };
+	const SLboolean req[1] = { SL_BOOLEAN_FALSE };
+	result = (*engineEngine)->CreateOutputMix(engineEngine, &outputMixObject, 1,
+			ids, req);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("engineObject CreateOutputMix failure.");
+		(*engineObject)->Destroy(engineObject);
+		engineObject = NULL;
+		engineEngine = NULL;
+		return -1;
+	}
+
+	// realize the output mix
+	result = (*outputMixObject)->Realize(outputMixObject, SL_BOOLEAN_FALSE );
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("outputMixObject Realize failure.");
+
+		(*outputMixObject)->Destroy(outputMixObject);
+		outputMixObject = NULL;
+		outputMixEnvironmentalReverb = NULL;
+		(*engineObject)->Destroy(engineObject);
+		engineObject = NULL;
+		engineEngine = NULL;
+		return -1;
+	}
+
+	// get the environmental reverb interface
+	// this could fail if the environmental reverb effect is not available,
+	// either because the feature is not present, excessive CPU load, or
+	// the required MODIFY_AUDIO_SETTINGS permission was not requested and granted
+	result = (*outputMixObject)->GetInterface(outputMixObject,
+			SL_IID_ENVIRONMENTALREVERB, &outputMixEnvironmentalReverb);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("outputMixObject Realize failure.");
+		(*outputMixObject)->Destroy(outputMixObject);
+		outputMixObject = NULL;
+		outputMixEnvironmentalReverb = NULL;
+		(*engineObject)->Destroy(engineObject);
+		engineObject = NULL;
+		engineEngine = NULL;
+		return -1;
+	}
+
+	LOGV2("OpenSL ES createEngine success.");
+	return 0;
+}
+
+static int createBufferQueueAudioPlayer(Player *player, OpenSLPlayer *sl,
+		int sample_rate, int channels) {
+	SLresult result;
+	SLuint32 channelMask;
+
+	// configure audio source
+	SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
+			SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, AUDIO_OUTPUT_BUFFERS };
+
+	if (channels == 2)
+		channelMask = SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
+	else
+		channelMask = SL_SPEAKER_FRONT_CENTER;
+
+	SLDataFormat_PCM format_pcm = { SL_DATAFORMAT_PCM, (SLuint32) channels,
+			(SLuint32) sample_rate * 1000,
+			SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16,
+			channelMask, SL_BYTEORDER_LITTLEENDIAN };
+
+	SLDataSource audioSrc = { &loc_bufq, &format_pcm };
+
+	// configure audio sink
+	SLDataLocator_OutputMix loc_outmix = { SL_DATALOCATOR_OUTPUTMIX,
+			outputMixObject };
+	SLDataSink audioSnk = { &loc_outmix, NULL };
+
+	// create audio player
+	const SLInterfaceID ids[3] = { SL_IID_BUFFERQUEUE, SL_IID_EFFECTSEND,
+			SL_IID_VOLUME };
+	const SLboolean req[3] =
+			{ SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE };
+	result = (*engineEngine)->CreateAudioPlayer(engineEngine,
+			&sl->bqPlayerObject, &audioSrc, &audioSnk, 3, ids, req);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("CreateAudioPlayer failure.");
+		return -1;
+	}
+
+	// realize the player
+	result = (*sl->bqPlayerObject)->Realize(sl->bqPlayerObject,
+			SL_BOOLEAN_FALSE );
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject Realize failure.");
+		return -1;
+	}
+
+	// get the play interface
+	result = (*sl->bqPlayerObject)->GetInterface(sl->bqPlayerObject,
+			SL_IID_PLAY, &sl->bqPlayerPlay);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject GetInterface failure.");
+		return -1;
+	}
+
+	// get the buffer queue interface
+	result = (*sl->bqPlayerObject)->GetInterface(sl->bqPlayerObject,
+			SL_IID_BUFFERQUEUE, &sl->bqPlayerBufferQueue);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject GetInterface failure.");
+		return -1;
+	}
+
+	// register callback on the buffer queue
+	result = (*sl->bqPlayerBufferQueue)->RegisterCallback(
+			sl->bqPlayerBufferQueue, bqPlayerCallback, player);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject RegisterCallback failure.");
+		return -1;
+	}
+
+	// get the effect send interface
+	result = (*sl->bqPlayerObject)->GetInterface(sl->bqPlayerObject,
+			SL_IID_EFFECTSEND, &sl->bqPlayerEffectSend);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject GetInterface SL_IID_EFFECTSEND failure.");
+		return -1;
+	}
+
+	// get the volume interface
+	result = (*sl->bqPlayerObject)->GetInterface(sl->bqPlayerObject,
+			SL_IID_VOLUME, &sl->bqPlayerVolume);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject GetInterface SL_IID_VOLUME failure.");
+		return -1;
+	}
+
+	// set the player's state to playing
+	result = (*sl->bqPlayerPlay)->SetPlayState(sl->bqPlayerPlay,
+			SL_PLAYSTATE_PLAYING );
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("bqPlayerObject SetPlayState SL_PLAYSTATE_PLAYING failure.");
+		return -1;
+	}
+
+	LOGV2("OpenSL ES CreateAudioPlayer success.");
+
+	return 0;
+}
+
+// the engine is created by the first player and destroyed by the last one
+static int acquireEngine() {
+	int ret = 0;
+
+	pthread_mutex_lock(&engineMutex);
+	if ((0 == engineRefs) && (createEngine() < 0)) {
+		ret = -1;
+	} else {
+		engineRefs++;
+	}
+	pthread_mutex_unlock(&engineMutex);
+
+	return ret;
+}
+
+/**
+ * Destroys the given object instance.
+ *
+ * @param object object instance. [IN/OUT]
+ */
+static void DestroyObject(SLObjectItf& object) {
+	if (0 != object)
+		(*object)->Destroy(object);
+
+	object = 0;
+}
+
+static void releaseEngine() {
+	pthread_mutex_lock(&engineMutex);
+	if (--engineRefs == 0) {
+		// Destroy output mix object
+		DestroyObject(outputMixObject);
+
+		// Destroy the engine instance
+		DestroyObject(engineObject);
+	}
+	pthread_mutex_unlock(&engineMutex);
+}
+
+static int opensl_open(Player *player, int sample_rate, int channels) {
+	OpenSLPlayer *sl = (OpenSLPlayer*) av_mallocz(sizeof(OpenSLPlayer));
+
+	if (NULL == sl) {
+		LOGE2("opensl_open : out of memory.");
+		return -1;
+	}
+	player->audio_sink_priv = sl;
+
+	if (acquireEngine() < 0) {
+		av_freep(&player->audio_sink_priv);
+		return -1;
+	}
+
+	return createBufferQueueAudioPlayer(player, sl, sample_rate, channels);
+}
+
+static int opensl_enqueue(Player *player, uint8_t *buf, int size) {
+	OpenSLPlayer *sl = (OpenSLPlayer*) player->audio_sink_priv;
+	SLresult result;
+
+	result = (*sl->bqPlayerBufferQueue)->Enqueue(sl->bqPlayerBufferQueue, buf,
+			size);
+	// the most likely other result is SL_RESULT_BUFFER_INSUFFICIENT,
+	// which for this code example would indicate a programming error
+	if (SL_RESULT_SUCCESS != result) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int64_t opensl_get_position(Player *player) {
+	OpenSLPlayer *sl = (OpenSLPlayer*) player->audio_sink_priv;
+	SLmillisecond position;
+
+	if (SL_RESULT_SUCCESS
+			!= (*sl->bqPlayerPlay)->GetPosition(sl->bqPlayerPlay, &position)) {
+		return -1;
+	}
+
+	return position;
+}
+
+static void opensl_pause(Player *player, int pause) {
+	OpenSLPlayer *sl = (OpenSLPlayer*) player->audio_sink_priv;
+	SLresult result;
+
+	result = (*sl->bqPlayerPlay)->SetPlayState(sl->bqPlayerPlay,
+			pause ? SL_PLAYSTATE_PAUSED : SL_PLAYSTATE_PLAYING);
+	if (SL_RESULT_SUCCESS != result) {
+		LOGE2("opensl_pause : SetPlayState failure.");
+	}
+}
+
+static void opensl_close(Player *player) {
+	OpenSLPlayer *sl = (OpenSLPlayer*) player->audio_sink_priv;
+
+	// open may have failed before the engine was acquired
+	if (NULL == sl) {
+		return;
+	}
+
+	// or before the player was realized and its interfaces taken
+	if (NULL != sl->bqPlayerPlay) {
+		(*sl->bqPlayerPlay)->SetPlayState(sl->bqPlayerPlay,
+				SL_PLAYSTATE_STOPPED );
+	}
+	if (NULL != sl->bqPlayerBufferQueue) {
+		(*sl->bqPlayerBufferQueue)->Clear(sl->bqPlayerBufferQueue);
+	}
+
+	// Destroy audio player object
+	DestroyObject(sl->bqPlayerObject);
+
+	releaseEngine();
+	av_freep(&player->audio_sink_priv);
+}
+
+AudioSink opensl_audio_sink = { "opensl", opensl_open, opensl_enqueue,
+		opensl_get_position, opensl_pause, opensl_close };
@@ -3,10 +3,20 @@
 
 #include "player.h"
 
-#define TEST_FILE_TFCARD "/mnt/extSdCard/clear.ts"
+/* packets read per run of the demux task */
+#define DEMUX_SLICE_PACKETS 16
+/* the demuxer waits when the queues hold this many bytes */
+#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
+/* or this many packets of every stream */
+#define MIN_FRAMES 25
+/* input throughput is measured over this much wall time */
+#define INPUT_RATE_WINDOW_US 1000000
+/* a slow input raises the high watermark up to this many times */
+#define BUFFER_HIGH_MAX_SCALE 4
 
-static int av_sync_type = AV_SYNC_AUDIO_MASTER;
-GlobalContext global_context;
+static int demux_packets(void *opaque);
+static int open_audio(void *opaque);
+static int check_buffering(void *opaque);
 
 static void sigterm_handler(int sig) {
 	av_log(NULL, AV_LOG_ERROR, "sigterm_handler : sig is %d \n", sig);
@@ -18,29 +28,449 @@ static void ffmpeg_log_callback(void *ptr, int level, const char *fmt,
 	//__android_log_vprint(ANDROID_LOG_DEBUG, "FFmpeg", fmt, vl);
 }
 
-double get_master_clock() {
-	if (av_sync_type == AV_SYNC_VIDEO_MASTER) {
-		return get_video_clock();
-	} else if (av_sync_type == AV_SYNC_AUDIO_MASTER) {
-		return get_audio_clock();
-	} else {
-		return get_audio_clock();
+// a stopped player, startPlayer() plays it
+Player *createPlayer(AudioSink *audio_sink, VideoSink *video_sink) {
+	Player *player = (Player*) av_mallocz(sizeof(Player));
+	pthread_condattr_t attr;
+
+	if (NULL == player) {
+		av_log(NULL, AV_LOG_ERROR, "createPlayer : out of memory. \n");
+		return NULL;
 	}
+
+	pthread_mutex_init(&player->pause_mutex, NULL);
+	pthread_cond_init(&player->pause_cond, NULL);
+	pthread_mutex_init(&player->pictq_mutex, NULL);
+	pthread_mutex_init(&player->timer_mutex, NULL);
+	// refresh deadlines are on the monotonic clock, see wait_refresh()
+	pthread_condattr_init(&attr);
+#ifndef HAVE_PTHREAD_COND_TIMEDWAIT_MONOTONIC
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(&player->timer_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&player->audio_clock_mutex, NULL);
+	pthread_mutex_init(&player->audio_enqueue_mutex, NULL);
+
+	// stopPlayer() may abort them before open_media() runs
+	packet_queue_init(&player->video_queue);
+	packet_queue_init(&player->audio_queue);
+
+	player->playback_rate = 1.0;
+	player->audio_filter_rate = 1.0;
+	player->audio_reconfigure = 1;
+	player->audio_clock_last = NAN;
+	player->video_stream_index = -1;
+	player->audio_stream_index = -1;
+	player->preroll_audio_ms = PREROLL_AUDIO_MS;
+	player->buffer_low_ms = BUFFER_LOW_MS;
+	player->buffer_high_ms = BUFFER_HIGH_MS;
+	player->read_ahead_bytes = IO_READ_AHEAD_BYTES;
+	player->source.fd = -1;
+	metrics_reset(&player->metrics);
+
+	// avformat blocks on the network there, they get threads of their own
+	task_init_blocking(&player->open_task, "open", open_media, player);
+	task_init(&player->audio_open_task, "audio_open", open_audio, player);
+	task_init_blocking(&player->demux_task, "demux", demux_packets, player);
+	task_init(&player->video_task, "video_decode", decode_video, player);
+	task_init(&player->audio_task, "audio_start", start_audio, player);
+	task_init(&player->buffer_task, "buffering", check_buffering, player);
+
+	player->audio_sink = audio_sink;
+	player->video_sink = video_sink;
+
+	return player;
 }
 
-void* open_media(void *argv) {
+// stops the player if it still runs and frees it
+void destroyPlayer(Player *player) {
 	int i;
-	int err = 0;
-	int framecnt;
-	AVFormatContext *fmt_ctx = NULL;
-	AVDictionaryEntry *dict = NULL;
-	AVPacket pkt;
-	bool firstPacket = true;
-	int video_stream_index = -1;
-	int audio_stream_index = -1;
-	pthread_t thread1;
-	pthread_t thread2;
 
+	if (NULL == player) {
+		return;
+	}
+
+	// no task, render thread or sink callback runs after this
+	stopPlayer(player);
+
+#ifdef __ANDROID__
+	releaseNativeSurface(player);
+#endif
+	close_audio_output(player);
+
+	// the codec contexts belong to the streams, only their decoders are ours
+	if (player->vcodec_ctx) {
+		avcodec_close(player->vcodec_ctx);
+	}
+	if (player->acodec_ctx) {
+		avcodec_close(player->acodec_ctx);
+	}
+	if (player->fmt_ctx) {
+		avformat_close_input(&player->fmt_ctx);
+		avformat_network_deinit();
+	}
+	close_media_io(player);
+	av_freep(&player->source.path);
+	if (player->source.fd >= 0) {
+		close(player->source.fd);
+	}
+
+	packet_queue_flush(&player->video_queue);
+	packet_queue_flush(&player->audio_queue);
+	for (i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++) {
+		av_frame_free(&player->pictq[i].pFrame);
+	}
+	av_frame_free(&player->video_frame);
+
+	task_destroy(&player->open_task);
+	task_destroy(&player->audio_open_task);
+	task_destroy(&player->demux_task);
+	task_destroy(&player->video_task);
+	task_destroy(&player->audio_task);
+	task_destroy(&player->buffer_task);
+	pthread_mutex_destroy(&player->pause_mutex);
+	pthread_cond_destroy(&player->pause_cond);
+	pthread_mutex_destroy(&player->pictq_mutex);
+	pthread_mutex_destroy(&player->timer_mutex);
+	pthread_cond_destroy(&player->timer_cond);
+	pthread_mutex_destroy(&player->audio_clock_mutex);
+	pthread_mutex_destroy(&player->audio_enqueue_mutex);
+	pthread_mutex_destroy(&player->video_queue.mutex);
+	pthread_cond_destroy(&player->video_queue.cond);
+	pthread_mutex_destroy(&player->audio_queue.mutex);
+	pthread_cond_destroy(&player->audio_queue.cond);
+
+	av_free(player);
+}
+
+// the source of a player is set once, before startPlayer()
+static int set_source(Player *player, const char *caller) {
+	if (player->started || (player->source.type != SOURCE_NONE)) {
+		av_log(NULL, AV_LOG_ERROR, "%s : source already set. \n", caller);
+		return -1;
+	}
+
+	return 0;
+}
+
+// a file path or any url avformat has a protocol for
+int openPath(Player *player, const char *path) {
+	if (set_source(player, "openPath") < 0) {
+		return -1;
+	}
+
+	player->source.path = av_strdup(path);
+	if (NULL == player->source.path) {
+		return AVERROR(ENOMEM);
+	}
+	player->source.type = SOURCE_PATH;
+	return 0;
+}
+
+// length bytes of fd from offset, < 0 to its end. fd is duplicated, the
+// caller keeps its own.
+int openFd(Player *player, int fd, int64_t offset, int64_t length) {
+	if (set_source(player, "openFd") < 0) {
+		return -1;
+	}
+
+	if (offset < 0) {
+		av_log(NULL, AV_LOG_ERROR, "openFd : negative offset. \n");
+		return -1;
+	}
+
+	player->source.fd = dup(fd);
+	if (player->source.fd < 0) {
+		av_log(NULL, AV_LOG_ERROR, "openFd : dup failure. \n");
+		return AVERROR(errno);
+	}
+	player->source.type = SOURCE_FD;
+	player->source.offset = offset;
+	player->source.length = length;
+	return 0;
+}
+
+// media in memory, it must stay there until destroyPlayer()
+int openBuffer(Player *player, const uint8_t *data, int64_t size) {
+	if (set_source(player, "openBuffer") < 0) {
+		return -1;
+	}
+
+	if ((NULL == data) || (size <= 0)) {
+		av_log(NULL, AV_LOG_ERROR, "openBuffer : empty buffer. \n");
+		return -1;
+	}
+
+	player->source.type = SOURCE_BUFFER;
+	player->source.data = data;
+	player->source.length = size;
+	return 0;
+}
+
+// open and play the source on the worker pool, once per player
+int startPlayer(Player *player) {
+	if (player->started) {
+		av_log(NULL, AV_LOG_ERROR, "startPlayer : already started. \n");
+		return -1;
+	}
+
+	if (SOURCE_NONE == player->source.type) {
+		av_log(NULL, AV_LOG_ERROR, "startPlayer : no source. \n");
+		return -1;
+	}
+
+	player->started = 1;
+	player->start_us = av_gettime_relative();
+	task_start(&player->open_task);
+	return 0;
+}
+
+// before startPlayer(), 0 keeps the avformat default. analyzeduration is us.
+// fast_start skips probing when the container headers describe every stream.
+int setProbeOptions(Player *player, int64_t probesize, int64_t analyzeduration,
+		int fast_start) {
+	if ((probesize < 0) || (analyzeduration < 0)) {
+		av_log(NULL, AV_LOG_ERROR, "setProbeOptions : negative limit. \n");
+		return -1;
+	}
+
+	player->probesize = probesize;
+	player->analyzeduration = analyzeduration;
+	player->fast_start = fast_start;
+	return 0;
+}
+
+// before startPlayer(), ms of audio read before playback starts
+int setPrerollDuration(Player *player, int audio_ms) {
+	if (audio_ms < 0) {
+		av_log(NULL, AV_LOG_ERROR, "setPrerollDuration : %d out of range. \n",
+				audio_ms);
+		return -1;
+	}
+
+	player->preroll_audio_ms = audio_ms;
+	return 0;
+}
+
+// before startPlayer(), playback is held when less than low_ms of media is
+// queued, until high_ms is; more for inputs slower than the media
+int setBufferingWatermarks(Player *player, int low_ms, int high_ms) {
+	if ((low_ms < 0) || (high_ms < low_ms)) {
+		av_log(NULL, AV_LOG_ERROR,
+				"setBufferingWatermarks : %d, %d out of range. \n", low_ms,
+				high_ms);
+		return -1;
+	}
+
+	player->buffer_low_ms = low_ms;
+	player->buffer_high_ms = high_ms;
+	return 0;
+}
+
+// previews run when no foreground player has work, from their next slice
+void setPlayerPriority(Player *player, int priority) {
+	player->priority = priority;
+	task_set_priority(&player->open_task, priority);
+	task_set_priority(&player->audio_open_task, priority);
+	task_set_priority(&player->demux_task, priority);
+	task_set_priority(&player->video_task, priority);
+	task_set_priority(&player->audio_task, priority);
+	task_set_priority(&player->buffer_task, priority);
+}
+
+// the last picture was shown and the last sample played
+int playback_finished(Player *player) {
+	// not opened yet
+	if (!player->vstream && !player->astream) {
+		return 0;
+	}
+
+	if (player->vstream && !video_output_finished(player)) {
+		return 0;
+	}
+
+	return !player->astream || audio_output_finished(player);
+}
+
+// Playback is held while paused or rebuffering: the clocks freeze and the
+// sink stops, and both pick up without a jump when neither holds it any
+// more. reason is player->pause or player->buffering, pause_mutex held.
+static void hold_playback(Player *player, int *reason, int hold) {
+	int held = player->pause || player->buffering;
+	double paused;
+
+	*reason = hold;
+
+	if (!held && hold) {
+		player->pause_time = av_gettime_relative() / 1000000.0;
+
+		set_clock_paused(&player->audclk, 1);
+		set_clock_paused(&player->vidclk, 1);
+		set_clock_paused(&player->extclk, 1);
+		pauseAudioPlayer(player, 1);
+	} else if (held && !player->pause && !player->buffering) {
+		paused = av_gettime_relative() / 1000000.0 - player->pause_time;
+
+		video_refresh_resume(player, paused);
+		pauseAudioPlayer(player, 0);
+		set_clock_paused(&player->audclk, 0);
+		set_clock_paused(&player->vidclk, 0);
+		set_clock_paused(&player->extclk, 0);
+	}
+}
+
+// park every worker and freeze the clocks, resume picks up without a jump
+int pausePlayer(Player *player) {
+	pthread_mutex_lock(&player->pause_mutex);
+
+	if (!player->pause) {
+		hold_playback(player, &player->pause, 1);
+	}
+
+	pthread_mutex_unlock(&player->pause_mutex);
+
+	// picture_thread parks now instead of at its next deadline
+	wake_refresh(player);
+
+	return 0;
+}
+
+int resumePlayer(Player *player) {
+	pthread_mutex_lock(&player->pause_mutex);
+
+	if (player->pause) {
+		hold_playback(player, &player->pause, 0);
+		pthread_cond_broadcast(&player->pause_cond);
+	}
+
+	pthread_mutex_unlock(&player->pause_mutex);
+
+	// the tasks went idle when they saw the pause
+	task_wake(&player->demux_task);
+	task_wake(&player->video_task);
+	task_wake(&player->audio_task);
+	wake_refresh(player);
+
+	return 0;
+}
+
+// wake every task and thread so it can see quit, and return once no task
+// of the player runs anymore. Not to be called from a task.
+void stopPlayer(Player *player) {
+	pthread_mutex_lock(&player->pause_mutex);
+	player->quit = 1;
+	pthread_cond_broadcast(&player->pause_cond);
+	pthread_mutex_unlock(&player->pause_mutex);
+
+	packet_queue_abort(&player->video_queue);
+	packet_queue_abort(&player->audio_queue);
+	abort_media_io(player);
+
+	wake_refresh(player);
+
+	// the open tasks start the others, so they are waited for first
+	task_wait(&player->open_task);
+	task_wait(&player->audio_open_task);
+	task_wake(&player->demux_task);
+	task_wake(&player->video_task);
+	task_wake(&player->audio_task);
+	task_wake(&player->buffer_task);
+	task_wait(&player->demux_task);
+	task_wait(&player->video_task);
+	task_wait(&player->audio_task);
+	task_wait(&player->buffer_task);
+
+	// the render thread closes its video sink, and the gl context, itself
+	if (player->picture_started) {
+		pthread_join(player->picture_tid, NULL);
+		player->picture_started = 0;
+	}
+
+	// no callback decodes audio after this
+	close_audio_sink(player);
+}
+
+// block while paused, return 1 when the player quits
+int wait_for_resume(Player *player) {
+	pthread_mutex_lock(&player->pause_mutex);
+	while (player->pause && !player->quit) {
+		pthread_cond_wait(&player->pause_cond, &player->pause_mutex);
+	}
+	pthread_mutex_unlock(&player->pause_mutex);
+
+	return player->quit;
+}
+
+int setPlaybackRate(Player *player, double rate) {
+	if ((rate < PLAYBACK_RATE_MIN) || (rate > PLAYBACK_RATE_MAX)) {
+		av_log(NULL, AV_LOG_ERROR, "setPlaybackRate : %f out of range. \n",
+				rate);
+		return -1;
+	}
+
+	// audio graph and video timer pick the new rate up on their next frame
+	player->playback_rate = rate;
+	return 0;
+}
+
+// early drops are the frames skip_frame made the decoder discard
+int getFrameDrops(Player *player, int64_t *late, int64_t *early) {
+	int64_t *counters = player->metrics.counters;
+
+	*late = counters[METRIC_FRAMES_DROPPED_LATE];
+	*early = counters[METRIC_FRAMES_DROPPED_EARLY];
+	return 0;
+}
+
+int getMetrics(Player *player, Metrics *snapshot) {
+	metrics_snapshot(&player->metrics, snapshot);
+	return 0;
+}
+
+// called before the media is opened, e.g. external master for muted playback
+int setSyncType(Player *player, int sync_type) {
+	if ((sync_type < AV_SYNC_AUDIO_MASTER)
+			|| (sync_type > AV_SYNC_EXTERNAL_MASTER)) {
+		av_log(NULL, AV_LOG_ERROR, "setSyncType : unknown type %d. \n",
+				sync_type);
+		return -1;
+	}
+
+	player->av_sync_type = sync_type;
+	return 0;
+}
+
+// the requested type, unless its stream is missing
+int get_master_sync_type(Player *player) {
+	if (player->av_sync_type == AV_SYNC_VIDEO_MASTER) {
+		if (player->vstream)
+			return AV_SYNC_VIDEO_MASTER;
+		else
+			return AV_SYNC_AUDIO_MASTER;
+	} else if (player->av_sync_type == AV_SYNC_AUDIO_MASTER) {
+		if (player->astream && !player->audio_failed)
+			return AV_SYNC_AUDIO_MASTER;
+		else
+			return AV_SYNC_EXTERNAL_MASTER;
+	} else {
+		return AV_SYNC_EXTERNAL_MASTER;
+	}
+}
+
+double get_master_clock(Player *player) {
+	switch (get_master_sync_type(player)) {
+	case AV_SYNC_VIDEO_MASTER:
+		return get_clock(&player->vidclk);
+	case AV_SYNC_AUDIO_MASTER:
+		return get_clock(&player->audclk);
+	default:
+		return get_clock(&player->extclk);
+	}
+}
+
+// process wide setup, once for every player
+static void init_ffmpeg() {
 	// register INT/TERM signal
 	signal(SIGINT, sigterm_handler); /* Interrupt (ANSI).    */
 	signal(SIGTERM, sigterm_handler); /* Termination (ANSI).  */
@@ -53,26 +483,475 @@ void* open_media(void *argv) {
 	/* register all codecs, demux and protocols */
 	avfilter_register_all();
 	av_register_all();
+}
+
+// avformat calls it while blocked in I/O, stopPlayer() must not wait on it
+static int decode_interrupt_cb(void *opaque) {
+	return ((Player*) opaque)->quit;
+}
+
+// ms of media in q, -1 when its packets carry no duration
+static int queue_ms(PacketQueue *q, AVStream *st) {
+	if ((q->nb_packets > 0) && (0 == q->duration)) {
+		return -1;
+	}
+
+	return (int) (q->duration * av_q2d(st->time_base) * 1000);
+}
+
+// q has min_packets and, when its packets tell, min_ms of media
+static int queue_holds(PacketQueue *q, AVStream *st, int min_packets,
+		int min_ms) {
+	int ms;
+
+	if (NULL == st) {
+		return 1;
+	}
+
+	ms = queue_ms(q, st);
+	return (q->nb_packets >= min_packets) && ((ms < 0) || (ms >= min_ms));
+}
+
+// The shorter of the queued media of both streams, -1 when neither tells.
+// A cover picture is no video stream that runs dry.
+static int buffered_ms(Player *player) {
+	int ms = -1, video_ms = -1;
+
+	if (player->vstream
+			&& !(player->vstream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+		video_ms = ms = queue_ms(&player->video_queue, player->vstream);
+	}
+	if (player->astream) {
+		ms = queue_ms(&player->audio_queue, player->astream);
+		if ((video_ms >= 0) && ((ms < 0) || (video_ms < ms))) {
+			ms = video_ms;
+		}
+	}
+
+	return ms;
+}
+
+// The decoders have enough to work on, reading more only costs memory.
+// Rebuffering reads until buffering_check() resumes playback.
+static int demux_queues_full(Player *player) {
+	PacketQueue *vq = &player->video_queue;
+	PacketQueue *aq = &player->audio_queue;
+
+	if (vq->size + aq->size > MAX_QUEUE_SIZE) {
+		return 1;
+	}
+
+	if (player->buffering) {
+		return 0;
+	}
+
+	return queue_holds(vq, player->vstream, MIN_FRAMES + 1,
+			player->buffer_high_ms)
+			&& queue_holds(aq, player->astream, MIN_FRAMES + 1,
+					player->buffer_high_ms);
+}
+
+// a decoder may run dry soon, half way down so the demuxer is not woken for
+// every packet
+static int demux_queues_low(Player *player) {
+	PacketQueue *vq = &player->video_queue;
+	PacketQueue *aq = &player->audio_queue;
+
+	if (vq->size + aq->size > MAX_QUEUE_SIZE / 2) {
+		return 0;
+	}
+
+	return !queue_holds(vq, player->vstream, MIN_FRAMES / 2,
+			player->buffer_high_ms / 2)
+			|| !queue_holds(aq, player->astream, MIN_FRAMES / 2,
+					player->buffer_high_ms / 2);
+}
+
+// audio is ready when enough of it is read, or when no more of it will be
+static int preroll_audio_ready(Player *player) {
+	PacketQueue *aq = &player->audio_queue;
+
+	if (!player->astream || player->eof || demux_queues_full(player)) {
+		return 1;
+	}
+
+	return aq->duration * av_q2d(player->astream->time_base) * 1000
+			>= player->preroll_audio_ms;
+}
+
+// Start playback once the first picture is decoded and preroll_audio_ms
+// of audio is queued: the sink gets its first buffers and the video timer
+// starts from now, not from the open, so no picture is late at the start.
+// Called by the demux and video tasks whenever they made progress.
+void preroll_check(Player *player) {
+	VideoPicture *vp;
+
+	if (player->preroll != PREROLL_BUFFERING) {
+		return;
+	}
+
+	if ((0 == player->pictq_size) && !player->video_finished) {
+		return;
+	}
+
+	if (!preroll_audio_ready(player)) {
+		return;
+	}
+
+	// both tasks may get here, only one starts playback
+	if (!__sync_bool_compare_and_swap(&player->preroll, PREROLL_BUFFERING,
+			PREROLL_STARTING)) {
+		return;
+	}
+
+	// the first picture is shown right away, the next ones by their pts.
+	// picture_thread waits for STARTED, so it never sees the timer unset.
+	pthread_mutex_lock(&player->pictq_mutex);
+	if (player->pictq_size > 0) {
+		vp = &player->pictq[player->pictq_rindex];
+		player->frame_last_pts = vp->pts;
+	}
+	pthread_mutex_unlock(&player->pictq_mutex);
+
+	pthread_mutex_lock(&player->timer_mutex);
+	player->frame_timer = av_gettime_relative() / 1000000.0;
+	schedule_refresh(player, 0);
+	player->preroll = PREROLL_STARTED;
+	pthread_mutex_unlock(&player->timer_mutex);
+
+	LOGV("preroll_check : started after %" PRId64 " ms.",
+			(av_gettime_relative() - player->start_us) / 1000);
+
+	if (player->astream) {
+		task_start(&player->audio_task);
+	}
+	wake_refresh(player);
+}
+
+// the input throughput in % of the media bitrate, -1 when not known
+static int input_percent(Player *player) {
+	if ((player->input_rate <= 0) || (player->media_rate <= 0)) {
+		return -1;
+	}
+
+	return (int) (player->input_rate * 100 / player->media_rate);
+}
+
+// A slow input drains the queues while playing, so more must be queued
+// before playback goes on or it is held again right away.
+static int buffer_target_ms(Player *player) {
+	int percent = input_percent(player);
+
+	if ((percent < 0) || (percent >= 100)) {
+		return player->buffer_high_ms;
+	}
+
+	return (int) (player->buffer_high_ms
+			* FFMIN(100.0 / FFMAX(percent, 1), BUFFER_HIGH_MAX_SCALE));
+}
+
+// the demuxer read bytes in read_time us, the rate is the bytes per second
+// of reading, so the time the queues were full does not count
+static void measure_input(Player *player, int bytes, int64_t read_time) {
+	int64_t now = av_gettime_relative();
+	double rate;
+
+	player->input_bytes += bytes;
+	player->input_read_time += read_time;
+	if (now - player->input_window_start < INPUT_RATE_WINDOW_US) {
+		return;
+	}
+
+	if (player->input_read_time > 0) {
+		rate = player->input_bytes * 1000000.0 / player->input_read_time;
+		player->input_rate = (player->input_rate > 0)
+				? 0.7 * player->input_rate + 0.3 * rate : rate;
+	}
+
+	player->input_bytes = 0;
+	player->input_read_time = 0;
+	player->input_window_start = now;
+}
+
+static void set_buffering(Player *player, int buffering, int ms) {
+	int64_t now = av_gettime_relative();
+
+	pthread_mutex_lock(&player->pause_mutex);
+	hold_playback(player, &player->buffering, buffering);
+	pthread_mutex_unlock(&player->pause_mutex);
+
+	if (buffering) {
+		player->buffering_start = now;
+		metrics_count(&player->metrics, METRIC_REBUFFERS);
+	} else {
+		metrics_add(&player->metrics, METRIC_REBUFFER_TIME,
+				now - player->buffering_start);
+		wake_refresh(player);
+	}
+
+	LOGV("set_buffering : %s, %d ms queued, input at %d%% of the bitrate.",
+			buffering ? "held" : "resumed", ms, input_percent(player));
+
+	if (player->notify) {
+		player->notify(player, buffering ? PLAYER_EVENT_BUFFERING_START
+				: PLAYER_EVENT_BUFFERING_END, ms, input_percent(player));
+	}
+}
+
+// Hold playback when the queues are about to run dry instead of letting the
+// clocks run on and skipping what arrives late, and go on once enough is
+// queued again. The end of the input ends rebuffering. Right after preroll
+// less than low_ms is queued, only an empty queue holds playback then.
+static void buffering_check(Player *player) {
+	int ms = buffered_ms(player);
+	PacketQueue *vq = &player->video_queue;
+	PacketQueue *aq = &player->audio_queue;
+
+	if ((player->preroll != PREROLL_STARTED) || (ms < 0)) {
+		return;
+	}
+
+	if (!player->buffering) {
+		if (!player->eof && !player->pause && (ms < player->buffer_low_ms)
+				&& (player->buffer_primed || (0 == ms))) {
+			set_buffering(player, 1, ms);
+		}
+		return;
+	}
+
+	if (player->eof || (ms >= buffer_target_ms(player))
+			|| (vq->size + aq->size > MAX_QUEUE_SIZE)) {
+		set_buffering(player, 0, ms);
+	}
+}
+
+// the buffering task, woken by the decoders when the queues run low and by
+// the demuxer while rebuffering
+static int check_buffering(void *opaque) {
+	Player *player = (Player*) opaque;
+
+	if (player->quit) {
+		return TASK_DONE;
+	}
+
+	buffering_check(player);
+	return TASK_WAIT;
+}
+
+// a decoder took a packet
+void wake_demux(Player *player) {
+	int ms;
+
+	if (demux_queues_low(player)) {
+		task_wake(&player->demux_task);
+	}
+
+	// the decoders run on the sink thread too, the pause is not theirs to do
+	if (!player->buffering && (PREROLL_STARTED == player->preroll)) {
+		ms = buffered_ms(player);
+		if (ms >= player->buffer_low_ms) {
+			player->buffer_primed = 1;
+		} else if ((ms >= 0) && (player->buffer_primed || (0 == ms))) {
+			task_wake(&player->buffer_task);
+		}
+	}
+}
+
+// the demux task, reads a few packets at a time until the queues are full;
+// a blocking task, av_read_frame() waits for the network
+static int demux_packets(void *opaque) {
+	Player *player = (Player*) opaque;
+	AVPacket pkt;
+	int64_t start;
+	int i, err, video = 0, audio = 0, ret = TASK_AGAIN;
+
+	for (i = 0; i < DEMUX_SLICE_PACKETS; i++) {
+		if (player->quit) {
+			ret = TASK_DONE;
+			break;
+		}
+
+		// resumePlayer() and wake_demux() queue us again
+		if (player->pause || demux_queues_full(player)) {
+			ret = TASK_WAIT;
+			break;
+		}
+
+		TRACE_BEGIN("demux_read");
+		start = av_gettime_relative();
+		err = av_read_frame(player->fmt_ctx, &pkt);
+		measure_input(player, (err < 0) ? 0 : pkt.size,
+				av_gettime_relative() - start);
+		TRACE_END("demux_read");
+		if (err < 0) {
+			// end of file, let both decoders drain their delayed frames
+			packet_queue_put_nullpacket(&player->video_queue);
+			packet_queue_put_nullpacket(&player->audio_queue);
+			player->eof = 1;
+			video = audio = 1;
+			ret = TASK_DONE;
+			break;
+		}
+
+		if (pkt.stream_index == player->video_stream_index) {
+			packet_queue_put(&player->video_queue, &pkt);
+			video = 1;
+		} else if (pkt.stream_index == player->audio_stream_index) {
+			packet_queue_put(&player->audio_queue, &pkt);
+			audio = 1;
+		} else {
+			av_free_packet(&pkt);
+		}
+	}
+
+	if (video) {
+		task_wake(&player->video_task);
+	}
+	if (audio && !player->audio_started) {
+		task_wake(&player->audio_task);
+	}
+	preroll_check(player);
+	if (player->buffering) {
+		task_wake(&player->buffer_task);
+	}
+
+	return ret;
+}
+
+// mp4 or mkv headers give everything the decoders need, probing would
+// only read and decode the first seconds of the file again
+static int stream_headers_complete(AVFormatContext *fmt_ctx) {
+	AVCodecParameters *par;
+	unsigned int i;
+
+	for (i = 0; i < fmt_ctx->nb_streams; i++) {
+		par = fmt_ctx->streams[i]->codecpar;
+		// the pixel format comes with the first decoded frame
+		if ((AVMEDIA_TYPE_VIDEO == par->codec_type)
+				&& ((par->width <= 0) || (par->height <= 0))) {
+			return 0;
+		}
+		if ((AVMEDIA_TYPE_AUDIO == par->codec_type)
+				&& ((par->sample_rate <= 0) || (par->channels <= 0))) {
+			return 0;
+		}
+	}
+
+	// without avformat_find_stream_info() nothing fills the old contexts
+	for (i = 0; i < fmt_ctx->nb_streams; i++) {
+		if (avcodec_parameters_to_context(fmt_ctx->streams[i]->codec,
+				fmt_ctx->streams[i]->codecpar) < 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// both decoders are open, the last of the open tasks starts playback
+static void open_done(Player *player) {
+	if (__sync_sub_and_fetch(&player->open_pending, 1) > 0) {
+		return;
+	}
+
+	// stopped while opening, nothing more to start
+	if (player->open_failed || player->quit) {
+		return;
+	}
+
+	metrics_set(&player->metrics, METRIC_OPEN_TIME,
+			av_gettime_relative() - player->start_us);
+
+	// init frame time, the timer itself starts in preroll_check()
+	player->frame_last_delay = 40e-3;
+
+	// rendering stays on its own thread, the sink may bind a gl context
+	if (pthread_create(&player->picture_tid, NULL, picture_thread, player)
+			!= 0) {
+		av_log(NULL, AV_LOG_ERROR, "open_done : pthread_create failure.\n");
+		player->open_failed = 1;
+		return;
+	}
+	player->picture_started = 1;
+
+	if (player->fmt_ctx->bit_rate > 0) {
+		player->media_rate = player->fmt_ctx->bit_rate / 8.0;
+	}
+	player->input_window_start = av_gettime_relative();
+
+	task_start(&player->demux_task);
+	task_start(&player->video_task);
+	task_start(&player->buffer_task);
+}
+
+// the open task, it opens player->source and starts the other tasks. On
+// failure open_failed is set, destroyPlayer() cleans up.
+int open_media(void *opaque) {
+	static pthread_once_t ffmpeg_once = PTHREAD_ONCE_INIT;
+	Player *player = (Player*) opaque;
+	const char *url = player->source.path ? player->source.path : "";
+	unsigned int i;
+	int err = 0;
+	AVFormatContext *fmt_ctx = NULL;
+	int video_stream_index = -1;
+	int audio_stream_index = -1;
+
+	pthread_once(&ffmpeg_once, init_ffmpeg);
+
+	player->vstream = NULL;
+	player->astream = NULL;
+
 	avformat_network_init();
 
 	fmt_ctx = avformat_alloc_context();
+	fmt_ctx->interrupt_callback.callback = decode_interrupt_cb;
+	fmt_ctx->interrupt_callback.opaque = player;
+	if (player->probesize > 0) {
+		fmt_ctx->probesize = player->probesize;
+	}
+	if (player->analyzeduration > 0) {
+		fmt_ctx->max_analyze_duration = player->analyzeduration;
+	}
+	// segments and playlists the demuxer opens come through the cache too
+	fmt_ctx->opaque = player;
+	fmt_ctx->io_open = stream_io_open;
+	fmt_ctx->io_close = stream_io_close;
 
-	err = avformat_open_input(&fmt_ctx, TEST_FILE_TFCARD, NULL, NULL);
+	// urls not ours to read go through the avformat protocols
+	if ((err = open_media_io(player, fmt_ctx)) < 0) {
+		avformat_free_context(fmt_ctx);
+		avformat_network_deinit();
+		goto failure;
+	}
+
+	err = avformat_open_input(&fmt_ctx, url, NULL, NULL);
 	if (err < 0) {
 		char errbuf[64];
 		av_strerror(err, errbuf, 64);
 		av_log(NULL, AV_LOG_ERROR, "avformat_open_input : err is %d , %s\n",
 				err, errbuf);
-		err = -1;
+		avformat_network_deinit();
 		goto failure;
 	}
+	player->fmt_ctx = fmt_ctx;
 
-	if ((err = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
+	if (player->fast_start && stream_headers_complete(fmt_ctx)) {
+		LOGV("open_media : fast start, the headers describe every stream.");
+	} else if ((err = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
 		av_log(NULL, AV_LOG_ERROR, "avformat_find_stream_info : err is %d \n",
 				err);
-		err = -1;
 		goto failure;
 	}
+	media_io_set_bitrate(player, fmt_ctx->bit_rate);
+
+	// streams starting at 0 or not, pts are seconds from the media start
+	if (fmt_ctx->start_time != AV_NOPTS_VALUE) {
+		player->start_time = (double) fmt_ctx->start_time / AV_TIME_BASE;
+	} else {
+		player->start_time = 0;
+	}
+	player->video_last_ts = AV_NOPTS_VALUE;
+	player->audio_last_ts = AV_NOPTS_VALUE;
 
 	// search video stream in all streams.
 	for (i = 0; i < fmt_ctx->nb_streams; i++) {
@@ -92,128 +971,74 @@ void* open_media(void *argv) {
 		}
 	}
 
-	// if no video and audio, exit
+	// if no video, exit. without audio the clock falls back to external
 	if (-1 == video_stream_index) {
 		goto failure;
 	}
+	player->video_stream_index = video_stream_index;
+	player->audio_stream_index = audio_stream_index;
 
-	// if no audio, exit
-	if (-1 == audio_stream_index) {
-		goto failure;
-	}
-
-	// open video
-	if (-1 != video_stream_index) {
-		global_context.vcodec_ctx = fmt_ctx->streams[video_stream_index]->codec;
-		global_context.vstream = fmt_ctx->streams[video_stream_index];
-		global_context.vcodec = avcodec_find_decoder(
-				global_context.vcodec_ctx->codec_id);
-		if (NULL == global_context.vcodec) {
-			av_log(NULL, AV_LOG_ERROR,
-					"avcodec_find_decoder video failure. \n");
-			goto failure;
-		}
-
-		if (avcodec_open2(global_context.vcodec_ctx, global_context.vcodec,
-				NULL) < 0) {
-			av_log(NULL, AV_LOG_ERROR, "avcodec_open2 failure. \n");
-			goto failure;
-		}
-
-		if ((global_context.vcodec_ctx->width > 0)
-				&& (global_context.vcodec_ctx->height > 0)) {
-
-			setBuffersGeometry(global_context.vcodec_ctx->width,
-					global_context.vcodec_ctx->height);
-		}
-
-		av_log(NULL, AV_LOG_ERROR, "video : width is %d, height is %d . \n",
-				global_context.vcodec_ctx->width,
-				global_context.vcodec_ctx->height);
-
-		// init picture queue lock and cond
-		pthread_mutex_init(&global_context.pictq_mutex, NULL);
-		pthread_cond_init(&global_context.pictq_cond, NULL);
-
-		pthread_mutex_init(&global_context.timer_mutex, NULL);
-		pthread_cond_init(&global_context.timer_cond, NULL);
-
-	}
-
-	// open audio
+	player->vcodec_ctx = fmt_ctx->streams[video_stream_index]->codec;
+	player->vstream = fmt_ctx->streams[video_stream_index];
 	if (-1 != audio_stream_index) {
-		global_context.acodec_ctx = fmt_ctx->streams[audio_stream_index]->codec;
-		global_context.astream = fmt_ctx->streams[audio_stream_index];
-		global_context.acodec = avcodec_find_decoder(
-				global_context.acodec_ctx->codec_id);
-		//av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1,
-		//	&global_context.acodec, 0);
-		if (NULL == global_context.acodec) {
-			av_log(NULL, AV_LOG_ERROR, "avcodec_find_decoder failure. \n");
-			err = -1;
-			goto failure;
-		}
-
-		//av_opt_set_int(global_context.acodec_ctx, "refcounted_frames", 1, 0);
-		if (avcodec_open2(global_context.acodec_ctx, global_context.acodec,
-				NULL) < 0) {
-			av_log(NULL, AV_LOG_ERROR, "avcodec_open2 failure. \n");
-			err = -1;
-			goto failure;
-		}
+		player->acodec_ctx = fmt_ctx->streams[audio_stream_index]->codec;
+		player->astream = fmt_ctx->streams[audio_stream_index];
 	}
 
-	// opensl es init
-	createEngine();
-	createBufferQueueAudioPlayer();
-
-	// init frame time
-	global_context.frame_timer = (double) av_gettime() / 1000000.0;
-	global_context.frame_last_delay = 40e-3;
-
-	// init video current pts
-	global_context.video_current_pts_time = av_gettime();
+	player->pictq_rindex = player->pictq_windex = 0;
 
-	global_context.pictq_rindex = global_context.pictq_windex = 0;
+	// init clocks, the master one is chosen by av_sync_type
+	init_audio_clock(player);
+	init_clock(&player->vidclk, &player->video_queue.serial);
+	init_clock(&player->extclk, &player->extclk.serial);
 
-	// init audio and video packet queue
-	packet_queue_init(&global_context.video_queue);
-	packet_queue_init(&global_context.audio_queue);
-
-	if (-1 != video_stream_index) {
-		pthread_create(&thread1, NULL, video_thread, NULL);
-		pthread_create(&thread2, NULL, picture_thread, NULL);
+	// the audio decoder and sink open on another worker meanwhile
+	player->open_pending = player->astream ? 2 : 1;
+	if (player->astream) {
+		task_start(&player->audio_open_task);
 	}
 
-	// read url media data circle
-	while ((av_read_frame(fmt_ctx, &pkt) == 0) && (!global_context.quit)) {
-		if (pkt.stream_index == video_stream_index) {
-			packet_queue_put(&global_context.video_queue, &pkt);
-		} else if (pkt.stream_index == audio_stream_index) {
-			packet_queue_put(&global_context.audio_queue, &pkt);
-			if (firstPacket) {
-				firstPacket = false;
-				fireOnPlayer();
-			}
-		} else {
-			av_free_packet(&pkt);
-		}
+	// open video
+	player->vcodec = avcodec_find_decoder(player->vcodec_ctx->codec_id);
+	if (NULL == player->vcodec) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec_find_decoder video failure. \n");
+		player->open_failed = 1;
+	} else if (avcodec_open2(player->vcodec_ctx, player->vcodec, NULL) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec_open2 failure. \n");
+		player->open_failed = 1;
+	} else {
+		av_log(NULL, AV_LOG_ERROR, "video : width is %d, height is %d . \n",
+				player->vcodec_ctx->width, player->vcodec_ctx->height);
 	}
 
-	// wait exit
-	while (!global_context.quit) {
-		usleep(1000);
-	}
+	open_done(player);
+	return TASK_DONE;
 
 	failure:
 
-	if (fmt_ctx) {
-		avformat_close_input(&fmt_ctx);
-		avformat_free_context(fmt_ctx);
-	}
+	player->open_failed = 1;
+	return TASK_DONE;
+}
 
-	avformat_network_deinit();
+// the audio open task, runs while open_media() opens the video decoder
+static int open_audio(void *opaque) {
+	Player *player = (Player*) opaque;
 
-	return 0;
-}
+	player->acodec = avcodec_find_decoder(player->acodec_ctx->codec_id);
+	//av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1,
+	//	&player->acodec, 0);
+	//av_opt_set_int(player->acodec_ctx, "refcounted_frames", 1, 0);
+	if (NULL == player->acodec) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec_find_decoder failure. \n");
+		player->open_failed = 1;
+	} else if (avcodec_open2(player->acodec_ctx, player->acodec, NULL) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "avcodec_open2 failure. \n");
+		player->open_failed = 1;
+	} else if (open_audio_sink(player) < 0) {
+		// the OpenSL engine comes up here too, without it nothing plays
+		player->open_failed = 1;
+	}
 
+	open_done(player);
+	return TASK_DONE;
+}
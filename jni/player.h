@@ -6,14 +6,12 @@ extern "C" {
 #endif
 
 #include <assert.h>
-#include <jni.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <android/log.h>
 #include <time.h>
 #include <utime.h>
 #include <inttypes.h>
@@ -23,11 +21,15 @@ extern "C" {
 #include <sys/syscall.h>
 #include <sched.h>
 
+#ifdef __ANDROID__
+#include <jni.h>
+
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#endif
 
 #include "config.h"
 
@@ -36,6 +38,7 @@ extern "C" {
 #include "libavutil/samplefmt.h"
 #include "libavutil/opt.h"
 #include "libavutil/channel_layout.h"
+#include "libavutil/audio_fifo.h"
 #include "libavformat/avformat.h"
 #include "libswscale/swscale.h"
 #include "libswresample/swresample.h"
@@ -55,23 +58,145 @@ extern "C" {
 #define UINT64_C uint64_t
 #endif
 
+#ifdef __ANDROID__
 #include <android/log.h>
+#define log_print __android_log_print
+#else
+// same priorities as android, the host build logs to stderr
+enum {
+	ANDROID_LOG_VERBOSE = 2,
+	ANDROID_LOG_DEBUG,
+	ANDROID_LOG_INFO,
+	ANDROID_LOG_WARN,
+	ANDROID_LOG_ERROR,
+};
+int log_print(int prio, const char *tag, const char *fmt, ...);
+#endif
 
 #define VIDEO_PICTURE_QUEUE_SIZE 30
+/* packets decoded while skipping, kept until their frame is known */
+#define VIDEO_SKIP_TRACK_MAX 64
+
+/* audio buffers queued in the sink at the same time */
+#define AUDIO_OUTPUT_BUFFERS 2
+/* bytes of one of them, 1 second of 48khz 32bit audio */
+#define AVCODEC_MAX_AUDIO_FRAME_SIZE 192000
+
+/* no AV correction is done if too big error */
+#define AV_NOSYNC_THRESHOLD 10.0
+
+/* supported playback rates, audio keeps its pitch */
+#define PLAYBACK_RATE_MIN 0.5
+#define PLAYBACK_RATE_MAX 4.0
 
 enum {
 	AV_SYNC_AUDIO_MASTER, AV_SYNC_VIDEO_MASTER, AV_SYNC_EXTERNAL_MASTER,
 };
 
+// MediaSource.type, see openPath(), openFd() and openBuffer()
+enum {
+	SOURCE_NONE, SOURCE_PATH, SOURCE_FD, SOURCE_BUFFER,
+};
+
+typedef struct MediaSource {
+	int type;
+	char *path;                    // SOURCE_PATH, a path or a url
+	int fd;                        // SOURCE_FD, our duplicate
+	int64_t offset;                // SOURCE_FD, where the media starts
+	int64_t length;                // bytes of media, < 0 to the end of fd
+	const uint8_t *data;           // SOURCE_BUFFER, owned by the caller
+} MediaSource;
+
+/* ring of the read-ahead thread of local files, see setReadAhead() */
+#define IO_READ_AHEAD_BYTES (4 * 1024 * 1024)
+
+/* audio queued before playback starts, see setPrerollDuration() */
+#define PREROLL_AUDIO_MS 200
+
+// Player.preroll, playback starts once both streams have enough data.
+// STARTING is held by the task that sets the timer up, until it is done.
+enum {
+	PREROLL_BUFFERING, PREROLL_STARTING, PREROLL_STARTED,
+};
+
+/* playback is held below the low watermark of queued media until the high
+ * one is queued, see setBufferingWatermarks() */
+#define BUFFER_LOW_MS 500
+#define BUFFER_HIGH_MS 2000
+
+// events of Player.notify, arg1 is the ms of media queued and arg2 the
+// input throughput in % of the media bitrate, -1 when not known
+enum {
+	PLAYER_EVENT_BUFFERING_START, PLAYER_EVENT_BUFFERING_END,
+};
+
 typedef struct PacketQueue {
 	AVPacketList *first_pkt, *last_pkt;
 	int nb_packets;
 	int size;
+	int64_t duration;              // of the packets, in stream time base
 	int abort_request;
 	int serial;
 	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 } PacketQueue;
 
+typedef struct Clock {
+	double pts; /* clock base */
+	double pts_drift; /* clock base minus time at which we updated the clock */
+	double last_updated;
+	double speed;
+	int serial; /* clock is based on a packet with this serial */
+	int paused;
+	int *queue_serial; /* pointer to the current packet queue serial, used for obsolete clock detection */
+	double (*get_source)(void *opaque); /* if set, the clock reads its pts from here */
+	void *opaque;
+} Clock;
+
+// counters of Metrics
+enum {
+	METRIC_FRAMES_DISPLAYED,
+	METRIC_FRAMES_SKIPPED,        // shown without delay to catch up
+	METRIC_FRAMES_REPEATED,       // shown for twice their duration
+	METRIC_FRAMES_DROPPED_LATE,   // late pictures not rendered
+	METRIC_VIDEO_PACKETS,         // packets sent to the video decoder
+	METRIC_VIDEO_FRAMES,          // frames out of the video decoder
+	METRIC_AUDIO_UNDERRUNS,       // the sink ran out of buffers
+	METRIC_OPEN_TIME,             // us from startPlayer() to the decoders open
+	METRIC_FIRST_FRAME_TIME,      // us from startPlayer() to the first picture
+	METRIC_CACHE_HITS,            // http urls read from the disk cache
+	METRIC_CACHE_MISSES,          // and from the network
+	METRIC_REBUFFERS,             // playback held until the queues refilled
+	METRIC_REBUFFER_TIME,         // us it was held in all
+	METRIC_FRAMES_DROPPED_EARLY,  // non reference frames the decoder skipped
+	METRIC_COUNTER_NB,
+};
+
+// histograms of Metrics
+enum {
+	HISTOGRAM_AV_DIFF,            // ms, shown picture vs master clock
+	HISTOGRAM_VIDEO_QUEUE,        // packets
+	HISTOGRAM_AUDIO_QUEUE,        // packets
+	HISTOGRAM_PICTURE_QUEUE,      // pictures
+	HISTOGRAM_DECODE_TIME,        // us per video frame
+	HISTOGRAM_NB,
+};
+
+#define HISTOGRAM_MAX_BUCKETS 12
+
+typedef struct Histogram {
+	int nb_buckets;
+	int64_t bounds[HISTOGRAM_MAX_BUCKETS - 1]; // upper bounds, the last bucket has none
+	int64_t counts[HISTOGRAM_MAX_BUCKETS];
+	int64_t sum;
+} Histogram;
+
+// a/v sync quality, metrics_snapshot() copies it value by value
+typedef struct Metrics {
+	int64_t counters[METRIC_COUNTER_NB];
+	Histogram histograms[HISTOGRAM_NB];
+} Metrics;
+
 typedef struct AudioParams {
 	int freq;
 	int channels;
@@ -87,7 +212,117 @@ typedef struct VideoPicture {
 	double pts;
 } VideoPicture;
 
-typedef struct GlobalContexts {
+/*
+ * A slice of work on the shared worker pool, see scheduler.cpp. run() returns
+ * TASK_AGAIN to go on after the other tasks, TASK_WAIT to sleep until
+ * task_wake() and TASK_DONE to stop. Blocking tasks run on a thread of their
+ * own instead.
+ */
+enum {
+	TASK_AGAIN, TASK_WAIT, TASK_DONE,
+};
+
+// internal states of a Task
+enum {
+	TASK_STOPPED, TASK_IDLE, TASK_QUEUED, TASK_RUNNING,
+};
+
+// the queue a task runs from, foreground playback goes before previews
+enum {
+	TASK_PRIORITY_HIGH, TASK_PRIORITY_LOW, TASK_PRIORITY_NB,
+};
+
+typedef struct Task {
+	const char *name;              // for traces
+	int (*run)(void *opaque);
+	void *opaque;
+	int priority;
+	int state;
+	int wakeup;                    // woken while running, run again
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int blocking;                  // may wait on I/O, not on the pool
+	int thread_started;            // until task_wait() joins the thread
+	pthread_t thread;
+} Task;
+
+void task_init(Task *task, const char *name, int (*run)(void *opaque),
+		void *opaque);
+void task_init_blocking(Task *task, const char *name,
+		int (*run)(void *opaque), void *opaque);
+void task_destroy(Task *task);
+void task_set_priority(Task *task, int priority);
+void task_start(Task *task);
+void task_wake(Task *task);
+void task_wait(Task *task);
+
+typedef struct Player Player;
+
+/*
+ * Where decoded audio goes. The sink pulls: once a buffer handed to enqueue()
+ * is consumed it calls audio_sink_callback(), which queues the next one.
+ * A sink keeps its state in player->audio_sink_priv.
+ */
+typedef struct AudioSink {
+	const char *name;
+	// interleaved S16 samples, close() also undoes a failed open
+	int (*open)(Player *player, int sample_rate, int channels);
+	// buf stays valid until the sink is done with it
+	int (*enqueue)(Player *player, uint8_t *buf, int size);
+	// ms of audio played since open, < 0 if the sink can not tell
+	int64_t (*get_position)(Player *player);
+	void (*pause)(Player *player, int pause);
+	void (*close)(Player *player);
+} AudioSink;
+
+// where pictures go, every call is made on picture_thread. attach and
+// detach follow the output window, they may be NULL, see video_sink_request().
+typedef struct VideoSink {
+	const char *name;
+	int (*open)(Player *player, int width, int height);
+	void (*display)(Player *player, AVFrame *frame);
+	void (*close)(Player *player);
+	int (*attach)(Player *player);
+	void (*detach)(Player *player);
+} VideoSink;
+
+// window changes of the video sink
+enum {
+	VIDEO_SINK_NONE, VIDEO_SINK_ATTACH, VIDEO_SINK_DETACH,
+};
+
+// sinks without a device, for headless runs
+extern AudioSink null_audio_sink;
+extern VideoSink null_video_sink;
+// like the null sinks, and write raw s16le / yuv to <prefix>.pcm / <prefix>.yuv
+extern AudioSink file_audio_sink;
+extern VideoSink file_video_sink;
+void set_file_sink_prefix(const char *prefix);
+
+#ifdef __ANDROID__
+extern AudioSink opensl_audio_sink;
+extern VideoSink gl_video_sink;
+#endif
+
+// one buffer queued in the audio sink
+typedef struct AudioOutputBuffer {
+	double pts;                    // pts of the first sample
+	int nb_samples;
+	double speed;                  // media seconds per played second
+} AudioOutputBuffer;
+
+/*
+ * Everything one playback owns. Players share nothing, so several of them
+ * can run in the same process.
+ */
+struct Player {
+#ifdef __ANDROID__
+	// for the surface
+	struct ANativeWindow *native_window;
+	jobject surface_object;        // the VideoSurface, a global ref
+	jobject source_buffer;         // the ByteBuffer of openBuffer(), too
+	int surface_paused;            // held while the surface was gone
+
 	// for egl
 	EGLDisplay eglDisplay;
 	EGLSurface eglSurface;
@@ -98,6 +333,71 @@ typedef struct GlobalContexts {
 	GLuint mTextureID[3];
 	GLuint glProgram;
 	GLint positionLoc;
+#endif
+
+	// for av output
+	AudioSink *audio_sink;
+	VideoSink *video_sink;
+	void *audio_sink_priv;
+	void *video_sink_priv;
+	int audio_sink_opened;
+
+	// events to the app, a PLAYER_EVENT_*, called from the player threads
+	void (*notify)(Player *player, int event, int arg1, int arg2);
+
+	// the media to play, set by openPath() and friends
+	MediaSource source;
+
+	// work of this player on the shared pool, a TASK_PRIORITY_*
+	int priority;
+	int started;
+	Task open_task;                // open_media(), a blocking task
+	Task audio_open_task;          // the audio decoder and sink, meanwhile
+	int open_pending;              // open tasks not done yet
+	Task demux_task;               // blocking too, av_read_frame()
+	Task video_task;
+	Task audio_task;               // queues the first audio buffers
+	Task buffer_task;              // see buffering_check()
+	int open_failed;               // the media can not be played
+
+	// the render thread, the gl context is bound to it
+	pthread_t picture_tid;
+	int picture_started;
+	int picture_running;           // sink calls go to it, under timer_mutex
+	int sink_request;              // a VIDEO_SINK_* for it to run
+
+	// for startup, see setProbeOptions()
+	int64_t probesize;             // bytes, 0 for the avformat default
+	int64_t analyzeduration;       // us, 0 for the avformat default
+	int fast_start;
+	int64_t start_us;              // when startPlayer() was called
+
+	// for demux
+	AVIOContext *io_ctx;           // our own input, see io.cpp
+	void *io_priv;
+	void *stream_priv;             // HLS prefetch, see stream.cpp
+	int64_t read_ahead_bytes;
+	double read_ahead_seconds;     // 0 reads ahead read_ahead_bytes
+	AVFormatContext *fmt_ctx;
+	int video_stream_index;
+	int audio_stream_index;
+	int eof;                       // every packet was read
+
+	// for the start of playback, see preroll_check()
+	int preroll;
+	int preroll_audio_ms;
+
+	// for rebuffering, see buffering_check()
+	int buffering;                 // playback held until the queues refill
+	int buffer_primed;             // low_ms was queued since playback began
+	int buffer_low_ms;
+	int buffer_high_ms;
+	int64_t buffering_start;       // us
+	int64_t input_bytes;           // read by the demuxer in this window
+	int64_t input_read_time;       // us it spent reading them
+	int64_t input_window_start;
+	double input_rate;             // bytes/s the input delivers, 0 unknown
+	double media_rate;             // bytes/s the media takes, 0 unknown
 
 	// for av decode
 	AVCodecContext *acodec_ctx;
@@ -107,64 +407,254 @@ typedef struct GlobalContexts {
 	AVCodec *vcodec;
 	AVCodec *acodec;
 
+	// for timestamps, pts are seconds from start_time
+	double start_time;
+	int64_t video_last_ts;
+	int64_t audio_last_ts;
+
 	// for av packet
 	PacketQueue video_queue;
 	PacketQueue audio_queue;
 
 	// for av sync
-	timer_t timer;
-
 	pthread_mutex_t pictq_mutex;
-	pthread_cond_t pictq_cond;
 	int pictq_size;
 	int pictq_windex;
 	int pictq_rindex;
 	VideoPicture pictq[VIDEO_PICTURE_QUEUE_SIZE];
-	int64_t video_current_pts_time;
+
+	// wakes picture_thread for new picture, pause/resume and quit
 	pthread_mutex_t timer_mutex;
 	pthread_cond_t timer_cond;
 
+	// for av sync, chosen by av_sync_type
+	int av_sync_type;
+	Clock audclk;
+	Clock vidclk;
+	Clock extclk;
+
 	double frame_last_delay;
 	double frame_last_pts;
-	double frame_timer;
+	double frame_timer;             // monotonic seconds, see av_gettime_relative()
+
+	// media seconds played per wall second
+	double playback_rate;
+
+	// for late frame dropping
+	int skip_nonref;
+	int64_t skip_track_pts[VIDEO_SKIP_TRACK_MAX]; // packets sent while skipping
+	int skip_track_count;
+
+	// for sync quality telemetry
+	Metrics metrics;
 
 	int quit;
 	int pause;
-} GlobalContext;
+	double pause_time;             // monotonic seconds when paused
+	pthread_mutex_t pause_mutex;
+	pthread_cond_t pause_cond;
+
+	// for audio output, see audio.cpp
+	AVFilterContext *in_audio_filter;  // the first filter in the audio chain
+	AVFilterContext *out_audio_filter; // the last filter in the audio chain
+	AVFilterGraph *agraph;         // audio filter graph
+	struct AudioParams audio_filter_src;
+	double audio_filter_rate;      // playback rate the graph applies
+	double audio_filter_start;     // pts of the first sample of the graph
+	int64_t audio_filter_next_pts; // in samples, for frames without pts
+	AVAudioFifo *audio_fifo;       // filtered samples waiting for output
+	int audio_reconfigure;         // the graph is built from the next frame
+	double audio_clock;
+	double audio_fifo_clock;       // pts at the end of the fifo data
+
+	// for audio sync correction when audio is not the master clock
+	struct SwrContext *swr_ctx;    // stretches or squeezes samples
+	uint8_t *audio_buf1;
+	unsigned int audio_buf1_size;
+	double audio_diff_cum;         // used for AV difference average computation
+	double audio_diff_avg_coef;
+	double audio_diff_threshold;
+	int audio_diff_avg_count;
+
+	// for the audio clock, buffers are consumed in the order they are enqueued
+	AudioOutputBuffer output_buffers[AUDIO_OUTPUT_BUFFERS];
+	int output_rindex;             // the buffer being played
+	int output_windex;
+	int output_count;
+	int64_t audio_frames_played;   // frames consumed by the sink
+	int64_t audio_played_time;     // when the head buffer started playing
+	int64_t audio_pause_time;
+	double audio_latency;          // smoothed delay after consumption
+	double audio_clock_last;       // keeps the clock monotonic
+	int audio_finished;            // all samples were handed out
+	int audio_failed;              // ended early, the clock is external
+	int audio_started;             // the sink refills itself
+	pthread_mutex_t audio_clock_mutex;
+	pthread_mutex_t audio_enqueue_mutex;
+	uint8_t decoded_audio_buf[AUDIO_OUTPUT_BUFFERS][AVCODEC_MAX_AUDIO_FRAME_SIZE];
+
+	// for video output, see video.cpp
+	AVFrame *video_frame;          // for the next decoded picture
+	int64_t video_decode_time;     // us spent in the decoder for it
+	double video_clock;
+	int late_streak;
+	double refresh_deadline;       // next refresh, monotonic seconds
+	int video_finished;            // the decoder returned its last frame
+};
 
-double get_master_clock();
-double get_audio_clock();
-double get_video_clock();
+Player *createPlayer(AudioSink *audio_sink, VideoSink *video_sink);
+void destroyPlayer(Player *player);
+int openPath(Player *player, const char *path);
+int openFd(Player *player, int fd, int64_t offset, int64_t length);
+int openBuffer(Player *player, const uint8_t *data, int64_t size);
+int startPlayer(Player *player);
+int setProbeOptions(Player *player, int64_t probesize, int64_t analyzeduration,
+		int fast_start);
+int setPrerollDuration(Player *player, int audio_ms);
+int setBufferingWatermarks(Player *player, int low_ms, int high_ms);
+void preroll_check(Player *player);
+void setPlayerPriority(Player *player, int priority);
+int playback_finished(Player *player);
+int pausePlayer(Player *player);
+int resumePlayer(Player *player);
+void stopPlayer(Player *player);
+int wait_for_resume(Player *player);
+int setPlaybackRate(Player *player, double rate);
+int setSyncType(Player *player, int sync_type);
+int getFrameDrops(Player *player, int64_t *late, int64_t *early);
+int getMetrics(Player *player, Metrics *snapshot);
+
+void metrics_reset(Metrics *m);
+void metrics_count(Metrics *m, int counter);
+void metrics_set(Metrics *m, int counter, int64_t value);
+void metrics_add(Metrics *m, int counter, int64_t value);
+void metrics_record(Metrics *m, int histogram, int64_t value);
+void metrics_snapshot(Metrics *m, Metrics *snapshot);
+int get_master_sync_type(Player *player);
+double get_master_clock(Player *player);
+double get_audio_clock(Player *player);
+
+double get_clock(Clock *c);
+void set_clock_at(Clock *c, double pts, int serial, double time);
+void set_clock(Clock *c, double pts, int serial);
+void set_clock_speed(Clock *c, double speed);
+void set_clock_paused(Clock *c, int paused);
+void init_clock(Clock *c, int *queue_serial);
+void set_clock_source(Clock *c, double (*get_source)(void *opaque),
+		void *opaque);
+void sync_clock_to_slave(Clock *c, Clock *slave);
 
 void packet_queue_init(PacketQueue *q);
-int packet_queue_get(PacketQueue *q, AVPacket *pkt);
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block);
+void packet_queue_abort(PacketQueue *q);
+void packet_queue_flush(PacketQueue *q);
 int packet_queue_put(PacketQueue *q, AVPacket *pkt);
-
-int setNativeSurface(JNIEnv *env, jobject obj, jobject surface);
-void* video_thread(void *argv);
+int packet_queue_put_nullpacket(PacketQueue *q);
+double stream_timestamp_to_seconds(Player *player, AVStream *st, int64_t ts,
+		int64_t *last_ts);
+
+int setReadAhead(Player *player, int64_t bytes, double seconds);
+int open_media_io(Player *player, AVFormatContext *fmt_ctx);
+void media_io_set_bitrate(Player *player, int64_t bit_rate);
+void abort_media_io(Player *player);
+void close_media_io(Player *player);
+
+int setStreamCache(const char *dir, int64_t max_bytes);
+int stream_url(const char *url);
+int open_stream(Player *player, const char *url, AVDictionary **options,
+		void **stream);
+int stream_read(void *opaque, uint8_t *buf, int buf_size);
+int64_t stream_seek(void *opaque, int64_t offset, int whence);
+void stream_close(void *opaque);
+int stream_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+		int flags, AVDictionary **options);
+void stream_io_close(AVFormatContext *s, AVIOContext *pb);
+void stream_abort(Player *player);
+void stream_stop(Player *player);
+
+// the task and thread functions take the Player as argument
+int open_media(void *opaque);
+void wake_demux(Player *player);
+int decode_video(void *opaque);
 void* picture_thread(void *argv);
-void video_refresh_timer();
-void schedule_refresh(int delay);
-void* open_media(void *argv);
-int32_t setBuffersGeometry(int32_t width, int32_t height);
-void renderSurface(AVFrame *frame);
-void Render(AVFrame *frame);
-int CreateProgram();
-int eglClose();
-void destroyPlayerAndEngine();
+void video_refresh_timer(Player *player);
+void schedule_refresh(Player *player, double deadline);
+void wake_refresh(Player *player);
+void video_refresh_resume(Player *player, double paused);
+void video_sink_request(Player *player, int request);
+int video_output_finished(Player *player);
+
+void init_audio_clock(Player *player);
+int open_audio_sink(Player *player);
+void close_audio_sink(Player *player);
+void close_audio_output(Player *player);
+void audio_sink_callback(Player *player);
+int audio_output_finished(Player *player);
+int fireOnPlayer(Player *player);
+int start_audio(void *opaque);
+void pauseAudioPlayer(Player *player, int pause);
+
+#ifdef __ANDROID__
+int setNativeSurface(Player *player, JNIEnv *env, jobject obj, jobject surface);
+void notifyVideoSurface(Player *player, int event, int arg1, int arg2);
+int32_t setBuffersGeometry(Player *player, int32_t width, int32_t height);
+void Render(Player *player, AVFrame *frame);
+int CreateProgram(Player *player);
+int eglClose(Player *player);
+void releaseNativeSurface(Player *player);
+#endif
+
+/*
+ * Logs below AVSYNC_LOG_LEVEL compile to nothing, their arguments are not
+ * evaluated. Above it, log_levels[] filters each category at runtime.
+ * Levels are the android priorities, ANDROID_LOG_VERBOSE to ANDROID_LOG_ERROR.
+ */
+#ifndef AVSYNC_LOG_LEVEL
+#ifdef NDEBUG
+#define AVSYNC_LOG_LEVEL ANDROID_LOG_WARN
+#else
+#define AVSYNC_LOG_LEVEL ANDROID_LOG_VERBOSE
+#endif
+#endif
 
-int createEngine();
-int createBufferQueueAudioPlayer();
-void fireOnPlayer();
+enum {
+	LOG_CATEGORY_PLAYER, // setup, surface and decoder errors
+	LOG_CATEGORY_VIDEO,  // per frame decisions of the picture path
+	LOG_CATEGORY_AUDIO,  // OpenSL ES and the audio decoder
+	LOG_CATEGORY_NB,
+};
 
+extern int log_levels[LOG_CATEGORY_NB];
+int setLogLevel(int category, int level);
 
-extern GlobalContext global_context;
+#define AVSYNC_LOG(category, level, tag, ...) \
+	do { \
+		if (((level) >= AVSYNC_LOG_LEVEL) && ((level) >= log_levels[category])) \
+			log_print(level, tag, __VA_ARGS__); \
+	} while (0)
 
 #define TAG "FFmpeg"
-#define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGV(...) AVSYNC_LOG(LOG_CATEGORY_PLAYER, ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGE(...) AVSYNC_LOG(LOG_CATEGORY_PLAYER, ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+#define LOGV_FRAME(...) AVSYNC_LOG(LOG_CATEGORY_VIDEO, ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
 
 #define TAG2 "OpenSLES"
-#define LOGV2(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG, __VA_ARGS__)
+#define LOGV2(...) AVSYNC_LOG(LOG_CATEGORY_AUDIO, ANDROID_LOG_VERBOSE, TAG2, __VA_ARGS__)
+#define LOGE2(...) AVSYNC_LOG(LOG_CATEGORY_AUDIO, ANDROID_LOG_ERROR, TAG2, __VA_ARGS__)
+
+// pipeline stage tracing, build with -DAVSYNC_TRACE to record events
+char *trace_dump();
+#ifdef AVSYNC_TRACE
+void trace_event(const char *name, char phase);
+void trace_thread_name(const char *name);
+#define TRACE_BEGIN(name) trace_event(name, 'B')
+#define TRACE_END(name) trace_event(name, 'E')
+#define TRACE_THREAD(name) trace_thread_name(name)
+#else
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_THREAD(name) do {} while (0)
+#endif
 
 #ifdef __cplusplus
 }
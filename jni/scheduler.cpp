@@ -0,0 +1,330 @@
+#include <unistd.h>
+
+#include "player.h"
+
+/*
+ * One pool of workers runs the tasks of every player, as many workers as
+ * cores. Each worker has a deque per priority: it takes its own tasks from
+ * the tail, most recently queued first, and when it has none it steals from
+ * the head of the others. Higher priority tasks of any worker go before
+ * lower priority ones.
+ *
+ * A task runs a slice of work and returns. Blocked tasks return TASK_WAIT
+ * and are queued again by task_wake(), so no worker ever sleeps on a player.
+ *
+ * Opening and demuxing wait on the network, inside avformat where they can
+ * not return TASK_WAIT. Those are blocking tasks: they run the same way on a
+ * thread of their own, so a slow source never holds a worker.
+ */
+
+#define SCHEDULER_MAX_WORKERS 16
+#define TASK_DEQUE_SIZE 256
+
+typedef struct TaskDeque {
+	pthread_mutex_t mutex;
+	Task *tasks[TASK_DEQUE_SIZE];
+	unsigned int head, tail;   // tail - head tasks, the indexes wrap
+} TaskDeque;
+
+typedef struct Worker {
+	pthread_t thread;
+	int index;
+	TaskDeque deques[TASK_PRIORITY_NB];
+} Worker;
+
+static Worker workers[SCHEDULER_MAX_WORKERS];
+static int nb_workers;
+static unsigned int next_worker;   // for tasks queued by other threads
+static pthread_key_t worker_key;
+static pthread_once_t scheduler_once = PTHREAD_ONCE_INIT;
+
+// idle workers sleep until a task is queued
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static int nb_pending;
+
+static int deque_push(TaskDeque *d, Task *task, int at_head) {
+	pthread_mutex_lock(&d->mutex);
+
+	if (d->tail - d->head >= TASK_DEQUE_SIZE) {
+		pthread_mutex_unlock(&d->mutex);
+		return -1;
+	}
+
+	if (at_head) {
+		d->tasks[--d->head % TASK_DEQUE_SIZE] = task;
+	} else {
+		d->tasks[d->tail++ % TASK_DEQUE_SIZE] = task;
+	}
+
+	pthread_mutex_unlock(&d->mutex);
+	return 0;
+}
+
+static Task *deque_pop(TaskDeque *d, int from_head) {
+	Task *task = NULL;
+
+	pthread_mutex_lock(&d->mutex);
+
+	if (d->tail != d->head) {
+		if (from_head) {
+			task = d->tasks[d->head++ % TASK_DEQUE_SIZE];
+		} else {
+			task = d->tasks[--d->tail % TASK_DEQUE_SIZE];
+		}
+	}
+
+	pthread_mutex_unlock(&d->mutex);
+	return task;
+}
+
+// own tasks first, then steal, for each priority in turn
+static Task *find_task(Worker *w) {
+	Task *task;
+	int p, i;
+
+	for (p = 0; p < TASK_PRIORITY_NB; p++) {
+		task = deque_pop(&w->deques[p], 0);
+		for (i = 1; (NULL == task) && (i < nb_workers); i++) {
+			task = deque_pop(&workers[(w->index + i) % nb_workers].deques[p], 1);
+		}
+
+		if (task) {
+			__sync_fetch_and_sub(&nb_pending, 1);
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
+// on the deque of the calling worker, or of the next one for other threads;
+// yielded tasks go to the head so the worker gets to the others first
+static void submit_task(Task *task, int yielded) {
+	Worker *w = (Worker*) pthread_getspecific(worker_key);
+	int index, i;
+
+	// its thread waits on the task, the mutex is held
+	if (task->blocking) {
+		pthread_cond_broadcast(&task->cond);
+		return;
+	}
+
+	index = w ? w->index : (int) (__sync_fetch_and_add(&next_worker, 1)
+			% nb_workers);
+
+	for (i = 0; i < nb_workers; i++) {
+		if (deque_push(&workers[(index + i) % nb_workers].deques[task->priority],
+				task, yielded) == 0) {
+			break;
+		}
+	}
+
+	if (i == nb_workers) {
+		// a deque per worker holds every task of 60 players, not reached
+		av_log(NULL, AV_LOG_ERROR, "submit_task : %s lost, queues full. \n",
+				task->name);
+		return;
+	}
+
+	pthread_mutex_lock(&idle_mutex);
+	nb_pending++;
+	pthread_cond_signal(&idle_cond);
+	pthread_mutex_unlock(&idle_mutex);
+}
+
+static void run_task(Task *task) {
+	int ret;
+
+	pthread_mutex_lock(&task->mutex);
+	task->state = TASK_RUNNING;
+	task->wakeup = 0;
+	pthread_mutex_unlock(&task->mutex);
+
+	TRACE_BEGIN(task->name);
+	ret = task->run(task->opaque);
+	TRACE_END(task->name);
+
+	pthread_mutex_lock(&task->mutex);
+	if ((TASK_AGAIN == ret) || ((TASK_WAIT == ret) && task->wakeup)) {
+		task->state = TASK_QUEUED;
+		submit_task(task, TASK_AGAIN == ret);
+	} else if (TASK_WAIT == ret) {
+		task->state = TASK_IDLE;
+	} else {
+		task->state = TASK_STOPPED;
+		pthread_cond_broadcast(&task->cond);
+	}
+	pthread_mutex_unlock(&task->mutex);
+}
+
+static void *worker_thread(void *argv) {
+	Worker *w = (Worker*) argv;
+	Task *task;
+
+	pthread_setspecific(worker_key, w);
+	TRACE_THREAD("worker");
+
+	for (;;) {
+		task = find_task(w);
+		if (task) {
+			run_task(task);
+			continue;
+		}
+
+		pthread_mutex_lock(&idle_mutex);
+		while (nb_pending <= 0) {
+			pthread_cond_wait(&idle_cond, &idle_mutex);
+		}
+		pthread_mutex_unlock(&idle_mutex);
+	}
+
+	return NULL;
+}
+
+// runs a blocking task until it returns TASK_DONE, task_wait() joins it
+static void *blocking_thread(void *argv) {
+	Task *task = (Task*) argv;
+	int ret;
+
+	TRACE_THREAD(task->name);
+
+	pthread_mutex_lock(&task->mutex);
+	for (;;) {
+		while (TASK_IDLE == task->state) {
+			pthread_cond_wait(&task->cond, &task->mutex);
+		}
+		task->state = TASK_RUNNING;
+		task->wakeup = 0;
+		pthread_mutex_unlock(&task->mutex);
+
+		TRACE_BEGIN(task->name);
+		ret = task->run(task->opaque);
+		TRACE_END(task->name);
+
+		pthread_mutex_lock(&task->mutex);
+		if (TASK_DONE == ret) {
+			break;
+		}
+		task->state = ((TASK_WAIT == ret) && !task->wakeup) ?
+				TASK_IDLE : TASK_QUEUED;
+	}
+
+	task->state = TASK_STOPPED;
+	pthread_cond_broadcast(&task->cond);
+	pthread_mutex_unlock(&task->mutex);
+
+	return NULL;
+}
+
+// the pool lives as long as the process, it is started by the first task
+static void scheduler_init() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, p;
+
+	pthread_key_create(&worker_key, NULL);
+
+	nb_workers = (int) av_clip(cores, 1, SCHEDULER_MAX_WORKERS);
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].index = i;
+		for (p = 0; p < TASK_PRIORITY_NB; p++) {
+			pthread_mutex_init(&workers[i].deques[p].mutex, NULL);
+		}
+	}
+
+	for (i = 0; i < nb_workers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				&workers[i]) != 0) {
+			av_log(NULL, AV_LOG_ERROR,
+					"scheduler_init : pthread_create failure. \n");
+			// the queued tasks are stolen by the workers that did start
+			if (0 == i) {
+				abort();
+			}
+		}
+	}
+
+	LOGV("scheduler_init : %d workers.", nb_workers);
+}
+
+void task_init(Task *task, const char *name, int (*run)(void *opaque),
+		void *opaque) {
+	memset(task, 0, sizeof(Task));
+	task->name = name;
+	task->run = run;
+	task->opaque = opaque;
+	task->state = TASK_STOPPED;
+	pthread_mutex_init(&task->mutex, NULL);
+	pthread_cond_init(&task->cond, NULL);
+}
+
+// a task that may block, it gets a thread when started
+void task_init_blocking(Task *task, const char *name,
+		int (*run)(void *opaque), void *opaque) {
+	task_init(task, name, run, opaque);
+	task->blocking = 1;
+}
+
+void task_destroy(Task *task) {
+	pthread_mutex_destroy(&task->mutex);
+	pthread_cond_destroy(&task->cond);
+}
+
+void task_set_priority(Task *task, int priority) {
+	// read when the task is queued, a queued task keeps its place
+	task->priority = av_clip(priority, 0, TASK_PRIORITY_NB - 1);
+}
+
+// queue a stopped task, it runs until it returns TASK_DONE. A blocking task
+// must be waited for before it is started again.
+void task_start(Task *task) {
+	pthread_once(&scheduler_once, scheduler_init);
+
+	pthread_mutex_lock(&task->mutex);
+	if (TASK_STOPPED == task->state) {
+		task->state = TASK_QUEUED;
+		if (task->blocking) {
+			if (pthread_create(&task->thread, NULL, blocking_thread, task)
+					== 0) {
+				task->thread_started = 1;
+			} else {
+				// better late on the pool than never
+				av_log(NULL, AV_LOG_ERROR,
+						"task_start : %s thread failure. \n", task->name);
+				task->blocking = 0;
+			}
+		}
+		submit_task(task, 0);
+	}
+	pthread_mutex_unlock(&task->mutex);
+}
+
+// queue a waiting task, or run a running one again when it returns
+void task_wake(Task *task) {
+	pthread_mutex_lock(&task->mutex);
+	if (TASK_IDLE == task->state) {
+		task->state = TASK_QUEUED;
+		submit_task(task, 0);
+	} else if (TASK_RUNNING == task->state) {
+		task->wakeup = 1;
+	}
+	pthread_mutex_unlock(&task->mutex);
+}
+
+// block until the task returned TASK_DONE, it must not be waiting forever
+void task_wait(Task *task) {
+	int joinable;
+
+	pthread_mutex_lock(&task->mutex);
+	while (task->state != TASK_STOPPED) {
+		pthread_cond_wait(&task->cond, &task->mutex);
+	}
+	joinable = task->thread_started;
+	task->thread_started = 0;
+	pthread_mutex_unlock(&task->mutex);
+
+	// the thread still unlocks the mutex after it stopped
+	if (joinable) {
+		pthread_join(task->thread, NULL);
+	}
+}
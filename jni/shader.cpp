@@ -34,7 +34,7 @@ GLuint LoadShader(GLenum type, const char *shaderSrc) {
 			GLchar* infoLog = (GLchar*) malloc(sizeof(GLchar) * infoLen);
 
 			glGetShaderInfoLog(shader, infoLen, NULL, infoLog);
-			LOGV("Error compiling shader:\n%s\n", infoLog);
+			LOGE("Error compiling shader:\n%s\n", infoLog);
 
 			free(infoLog);
 		}
@@ -81,7 +81,7 @@ GLuint LoadProgram(const char *vShaderStr, const char *fShaderStr) {
 			GLchar* infoLog = (GLchar*) malloc(sizeof(GLchar) * infoLen);
 
 			glGetProgramInfoLog(programObject, infoLen, NULL, infoLog);
-			LOGV("Error linking program:\n%s\n", infoLog);
+			LOGE("Error linking program:\n%s\n", infoLog);
 
 			free(infoLog);
 		}
@@ -97,7 +97,7 @@ GLuint LoadProgram(const char *vShaderStr, const char *fShaderStr) {
 	return programObject;
 }
 
-int CreateProgram() {
+int CreateProgram(Player *player) {
 	GLuint programObject;
 
 	GLbyte vShaderStr[] = "attribute vec4 a_Position;  			\n"
@@ -146,16 +146,16 @@ int CreateProgram() {
 	}
 
 	// Store the program object
-	global_context.glProgram = programObject;
+	player->glProgram = programObject;
 
 	// Get the attribute locations
-	global_context.positionLoc = glGetAttribLocation(programObject,
+	player->positionLoc = glGetAttribLocation(programObject,
 			"v_position");
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-	glGenTextures(3, global_context.mTextureID);
+	glGenTextures(3, player->mTextureID);
 	for (int i = 0; i < 3; i++) {
-		glBindTexture(GL_TEXTURE_2D, global_context.mTextureID[i]);
+		glBindTexture(GL_TEXTURE_2D, player->mTextureID[i]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -164,25 +164,25 @@ int CreateProgram() {
 	return 0;
 }
 
-void Render(AVFrame *frame) {
+void Render(Player *player, AVFrame *frame) {
 	GLfloat vVertices[] = { 0.0f, 0.5f, 0.0f, -0.5f, -0.5f, 0.0f, 0.5f, -0.5f,
 			0.0f };
 	// Clear the color buffer
 	//glClear(GL_COLOR_BUFFER_BIT);
 
 	// Use the program object
-	glUseProgram(global_context.glProgram);
+	glUseProgram(player->glProgram);
 
 	//Get Uniform Variables Location
-	GLint textureUniformY = glGetUniformLocation(global_context.glProgram,
+	GLint textureUniformY = glGetUniformLocation(player->glProgram,
 			"tex_y");
-	GLint textureUniformU = glGetUniformLocation(global_context.glProgram,
+	GLint textureUniformU = glGetUniformLocation(player->glProgram,
 			"tex_u");
-	GLint textureUniformV = glGetUniformLocation(global_context.glProgram,
+	GLint textureUniformV = glGetUniformLocation(player->glProgram,
 			"tex_v");
 
-	int w = global_context.vcodec_ctx->width;
-	int h = global_context.vcodec_ctx->height;
+	int w = player->vcodec_ctx->width;
+	int h = player->vcodec_ctx->height;
 	GLubyte* y = (GLubyte*) frame->data[0];
 	GLubyte* u = (GLubyte*) frame->data[1];
 	GLubyte* v = (GLubyte*) frame->data[2];
@@ -190,33 +190,37 @@ void Render(AVFrame *frame) {
 	GLint u_width = frame->linesize[1];
 	GLint v_width = frame->linesize[2];
 
+	TRACE_BEGIN("upload");
+
 	// Set the viewport
-	glViewport(0, 0, y_width, global_context.vcodec_ctx->height);
+	glViewport(0, 0, y_width, player->vcodec_ctx->height);
 
 	//Y
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, global_context.mTextureID[0]);
+	glBindTexture(GL_TEXTURE_2D, player->mTextureID[0]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, y_width, h, 0, GL_LUMINANCE,
 			GL_UNSIGNED_BYTE, y);
 	glUniform1i(textureUniformY, 0);
 	//U
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, global_context.mTextureID[1]);
+	glBindTexture(GL_TEXTURE_2D, player->mTextureID[1]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, u_width, h / 2, 0,
 			GL_LUMINANCE, GL_UNSIGNED_BYTE, u);
 	glUniform1i(textureUniformU, 1);
 	//V
 	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, global_context.mTextureID[2]);
+	glBindTexture(GL_TEXTURE_2D, player->mTextureID[2]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, v_width, h / 2, 0,
 			GL_LUMINANCE, GL_UNSIGNED_BYTE, v);
 	glUniform1i(textureUniformV, 2);
 
+	TRACE_END("upload");
+
 	// Retrieve attribute locations for the shader program.
-	GLint aPositionLocation = glGetAttribLocation(global_context.glProgram,
+	GLint aPositionLocation = glGetAttribLocation(player->glProgram,
 			"a_Position");
 	GLint aTextureCoordinatesLocation = glGetAttribLocation(
-			global_context.glProgram, "a_TextureCoordinates");
+			player->glProgram, "a_TextureCoordinates");
 
 	// Order of coordinates: X, Y, S, T
 	// Triangle Fan
@@ -234,5 +238,7 @@ void Render(AVFrame *frame) {
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 6);
 
-	eglSwapBuffers(global_context.eglDisplay, global_context.eglSurface);
+	TRACE_BEGIN("swap");
+	eglSwapBuffers(player->eglDisplay, player->eglSurface);
+	TRACE_END("swap");
 }
@@ -0,0 +1,301 @@
+#include "player.h"
+
+#include "libavutil/avstring.h"
+
+/*
+ * Sinks without a device. The audio sink consumes its buffers in real time on
+ * its own thread, like a sound card would, so the audio clock and the a/v
+ * sync behave as on a device. The file sinks write what they consume.
+ */
+
+static char file_sink_prefix[1024] = "avsync-out";
+
+// null audio sink state, in player->audio_sink_priv
+typedef struct NullAudioSink {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint8_t *bufs[AUDIO_OUTPUT_BUFFERS];
+	int sizes[AUDIO_OUTPUT_BUFFERS];
+	int rindex;
+	int count;
+	int paused;
+	int closing;
+	int running;
+	int sample_rate;
+	int frame_bytes;
+	int64_t frames_consumed;
+	FILE *file;
+} NullAudioSink;
+
+// file video sink state, in player->video_sink_priv
+typedef struct FileVideoSink {
+	FILE *file;
+	uint8_t *buf;
+	unsigned int buf_size;
+} FileVideoSink;
+
+void set_file_sink_prefix(const char *prefix) {
+	av_strlcpy(file_sink_prefix, prefix, sizeof(file_sink_prefix));
+}
+
+static FILE *open_sink_file(const char *ext) {
+	char path[1100];
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s.%s", file_sink_prefix, ext);
+	file = fopen(path, "wb");
+	if (NULL == file) {
+		av_log(NULL, AV_LOG_ERROR, "open_sink_file : can not open %s. \n",
+				path);
+	}
+
+	return file;
+}
+
+// play each buffer for its duration, then ask for the next one
+static void *null_audio_thread(void *argv) {
+	Player *player = (Player*) argv;
+	NullAudioSink *sink = (NullAudioSink*) player->audio_sink_priv;
+	int64_t deadline = 0, now;
+	uint8_t *buf;
+	int size;
+
+	pthread_mutex_lock(&sink->mutex);
+
+	for (;;) {
+		if (sink->paused || (0 == sink->count)) {
+			while (!sink->closing && (sink->paused || (0 == sink->count))) {
+				pthread_cond_wait(&sink->cond, &sink->mutex);
+			}
+			// idle time is not played time
+			deadline = 0;
+		}
+
+		if (sink->closing) {
+			break;
+		}
+
+		buf = sink->bufs[sink->rindex];
+		size = sink->sizes[sink->rindex];
+		pthread_mutex_unlock(&sink->mutex);
+
+		if (sink->file) {
+			fwrite(buf, 1, size, sink->file);
+		}
+
+		now = av_gettime_relative();
+		if (deadline < now) {
+			deadline = now;
+		}
+		deadline += (int64_t) size / sink->frame_bytes * 1000000
+				/ sink->sample_rate;
+		if (deadline > now) {
+			av_usleep(deadline - now);
+		}
+
+		pthread_mutex_lock(&sink->mutex);
+		if (++sink->rindex >= AUDIO_OUTPUT_BUFFERS) {
+			sink->rindex = 0;
+		}
+		sink->count--;
+		sink->frames_consumed += size / sink->frame_bytes;
+		pthread_mutex_unlock(&sink->mutex);
+
+		// it enqueues the next buffer, so no lock may be held here
+		audio_sink_callback(player);
+
+		pthread_mutex_lock(&sink->mutex);
+	}
+
+	pthread_mutex_unlock(&sink->mutex);
+
+	return NULL;
+}
+
+// the file, if any, belongs to the sink even when this fails
+static int null_audio_start(Player *player, int sample_rate, int channels,
+		FILE *file) {
+	NullAudioSink *sink = (NullAudioSink*) av_mallocz(sizeof(NullAudioSink));
+
+	if (NULL == sink) {
+		av_log(NULL, AV_LOG_ERROR, "null_audio_start : out of memory. \n");
+		if (file) {
+			fclose(file);
+		}
+		return -1;
+	}
+
+	pthread_mutex_init(&sink->mutex, NULL);
+	pthread_cond_init(&sink->cond, NULL);
+	sink->sample_rate = sample_rate;
+	sink->frame_bytes = channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+	sink->file = file;
+	player->audio_sink_priv = sink;
+
+	if (pthread_create(&sink->thread, NULL, null_audio_thread, player) != 0) {
+		av_log(NULL, AV_LOG_ERROR,
+				"null_audio_start : pthread_create failure. \n");
+		return -1;
+	}
+	sink->running = 1;
+
+	return 0;
+}
+
+static int null_audio_open(Player *player, int sample_rate, int channels) {
+	return null_audio_start(player, sample_rate, channels, NULL);
+}
+
+static int file_audio_open(Player *player, int sample_rate, int channels) {
+	FILE *file = open_sink_file("pcm");
+
+	if (NULL == file) {
+		return -1;
+	}
+
+	return null_audio_start(player, sample_rate, channels, file);
+}
+
+static int null_audio_enqueue(Player *player, uint8_t *buf, int size) {
+	NullAudioSink *sink = (NullAudioSink*) player->audio_sink_priv;
+	int windex;
+
+	pthread_mutex_lock(&sink->mutex);
+
+	if (sink->count >= AUDIO_OUTPUT_BUFFERS) {
+		pthread_mutex_unlock(&sink->mutex);
+		return -1;
+	}
+
+	windex = (sink->rindex + sink->count) % AUDIO_OUTPUT_BUFFERS;
+	sink->bufs[windex] = buf;
+	sink->sizes[windex] = size;
+	sink->count++;
+
+	pthread_cond_signal(&sink->cond);
+	pthread_mutex_unlock(&sink->mutex);
+
+	return 0;
+}
+
+// nothing sits behind the sink, consumed is played
+static int64_t null_audio_get_position(Player *player) {
+	NullAudioSink *sink = (NullAudioSink*) player->audio_sink_priv;
+	int64_t position;
+
+	pthread_mutex_lock(&sink->mutex);
+	position = sink->frames_consumed * 1000 / sink->sample_rate;
+	pthread_mutex_unlock(&sink->mutex);
+
+	return position;
+}
+
+static void null_audio_pause(Player *player, int pause) {
+	NullAudioSink *sink = (NullAudioSink*) player->audio_sink_priv;
+
+	pthread_mutex_lock(&sink->mutex);
+	sink->paused = pause;
+	pthread_cond_signal(&sink->cond);
+	pthread_mutex_unlock(&sink->mutex);
+}
+
+static void null_audio_close(Player *player) {
+	NullAudioSink *sink = (NullAudioSink*) player->audio_sink_priv;
+
+	if (NULL == sink) {
+		return;
+	}
+
+	if (sink->running) {
+		pthread_mutex_lock(&sink->mutex);
+		sink->closing = 1;
+		pthread_cond_signal(&sink->cond);
+		pthread_mutex_unlock(&sink->mutex);
+
+		pthread_join(sink->thread, NULL);
+	}
+
+	if (sink->file) {
+		fclose(sink->file);
+	}
+
+	pthread_mutex_destroy(&sink->mutex);
+	pthread_cond_destroy(&sink->cond);
+	av_freep(&player->audio_sink_priv);
+}
+
+static int null_video_open(Player *player, int width, int height) {
+	return 0;
+}
+
+static void null_video_display(Player *player, AVFrame *frame) {
+}
+
+static void null_video_close(Player *player) {
+}
+
+static int file_video_open(Player *player, int width, int height) {
+	FileVideoSink *sink = (FileVideoSink*) av_mallocz(sizeof(FileVideoSink));
+
+	if (NULL == sink) {
+		av_log(NULL, AV_LOG_ERROR, "file_video_open : out of memory. \n");
+		return -1;
+	}
+	player->video_sink_priv = sink;
+
+	sink->file = open_sink_file("yuv");
+	if (NULL == sink->file) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// pictures are written tightly packed, in the decoder pixel format
+static void file_video_display(Player *player, AVFrame *frame) {
+	FileVideoSink *sink = (FileVideoSink*) player->video_sink_priv;
+	int size;
+
+	if ((NULL == sink) || (NULL == sink->file)) {
+		return;
+	}
+
+	size = av_image_get_buffer_size((enum AVPixelFormat) frame->format,
+			frame->width, frame->height, 1);
+	if (size < 0) {
+		return;
+	}
+
+	av_fast_malloc(&sink->buf, &sink->buf_size, size);
+	if (NULL == sink->buf) {
+		return;
+	}
+
+	av_image_copy_to_buffer(sink->buf, size, frame->data, frame->linesize,
+			(enum AVPixelFormat) frame->format, frame->width, frame->height, 1);
+	fwrite(sink->buf, 1, size, sink->file);
+}
+
+static void file_video_close(Player *player) {
+	FileVideoSink *sink = (FileVideoSink*) player->video_sink_priv;
+
+	if (NULL == sink) {
+		return;
+	}
+
+	if (sink->file) {
+		fclose(sink->file);
+	}
+	av_freep(&sink->buf);
+	av_freep(&player->video_sink_priv);
+}
+AudioSink null_audio_sink = { "null", null_audio_open, null_audio_enqueue,
+		null_audio_get_position, null_audio_pause, null_audio_close };
+VideoSink null_video_sink = { "null", null_video_open, null_video_display,
+		null_video_close, NULL, NULL };
+
+AudioSink file_audio_sink = { "file", file_audio_open, null_audio_enqueue,
+		null_audio_get_position, null_audio_pause, null_audio_close };
+VideoSink file_video_sink = { "file", file_video_open, file_video_display,
+		file_video_close, NULL, NULL };
@@ -0,0 +1,848 @@
+#include <dirent.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/md5.h"
+
+#include "player.h"
+
+/*
+ * Network input. http urls are read through a disk cache shared by every
+ * player: each url is one file named after its md5, written while it is
+ * read and kept once read to the end, so playing the same media again
+ * comes from the disk. The least recently used files go first when the
+ * cache is over its size.
+ *
+ * HLS playlists read through here are parsed, and threads of the player
+ * fetch the segments after the one the demuxer opened into the cache in
+ * parallel, so the demuxer does not wait a round trip per segment.
+ */
+
+// avio buffer of the streams the demuxer opens itself
+#define STREAM_BUFFER_SIZE (64 * 1024)
+// bytes copied per read of a prefetch
+#define STREAM_BLOCK_SIZE (64 * 1024)
+// a longer file is not an HLS playlist we parse
+#define STREAM_MAX_PLAYLIST (1024 * 1024)
+// media playlists of a player, e.g. a video and an audio rendition
+#define STREAM_MAX_PLAYLISTS 4
+// downloads in progress, of every player
+#define STREAM_MAX_FETCHES 32
+// threads downloading the segments of a player
+#define STREAM_PREFETCH_THREADS 2
+// segments fetched ahead of the one the demuxer reads
+#define STREAM_PREFETCH_SEGMENTS 3
+// md5 in hex
+#define CACHE_KEY_SIZE 33
+
+typedef struct CacheFetch {
+	char key[CACHE_KEY_SIZE];
+	int prefetch;                  // or a stream teed into the cache
+} CacheFetch;
+
+typedef struct CacheEntry {
+	char key[CACHE_KEY_SIZE];
+	time_t mtime;
+	int64_t size;
+} CacheEntry;
+
+// the cache of the process, see setStreamCache()
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_cond = PTHREAD_COND_INITIALIZER;
+static char *cache_dir;
+static int64_t cache_max_bytes;
+static CacheFetch fetches[STREAM_MAX_FETCHES];
+static int nb_fetches;
+
+typedef struct Playlist {
+	char *url;
+	char **segments;
+	int nb_segments;
+	char *last_opened;             // by the demuxer, found again on reloads
+	int next, end;                 // the segments to prefetch
+} Playlist;
+
+// Player.stream_priv, created with the first media playlist
+typedef struct Prefetch {
+	pthread_t threads[STREAM_PREFETCH_THREADS];
+	int nb_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	Playlist playlists[STREAM_MAX_PLAYLISTS];
+	int nb_playlists;
+	int abort;
+} Prefetch;
+
+// an url read by the demuxer, from the cache file or the network
+typedef struct HttpStream {
+	Player *player;
+	char *url;
+	char key[CACHE_KEY_SIZE];
+	AVIOContext *pb;               // NULL when read from the cache
+	int fd;                        // the cache file, or the one written
+	int writing;                   // pb is copied to fd
+	int64_t pos;
+	int64_t size;
+	char *playlist;                // the text so far of an HLS playlist
+	int playlist_size;
+	int is_playlist;
+} HttpStream;
+
+static void cache_key(const char *url, char *key) {
+	uint8_t md5[16];
+	int i;
+
+	av_md5_sum(md5, (const uint8_t*) url, (int) strlen(url));
+	for (i = 0; i < 16; i++) {
+		snprintf(key + 2 * i, 3, "%02x", md5[i]);
+	}
+}
+
+static void cache_path(const char *key, const char *suffix, char *path,
+		int size) {
+	snprintf(path, size, "%s/%s%s", cache_dir, key, suffix);
+}
+
+// cache_mutex held
+static CacheFetch *fetch_find(const char *key) {
+	int i;
+
+	for (i = 0; i < nb_fetches; i++) {
+		if (!strcmp(fetches[i].key, key)) {
+			return &fetches[i];
+		}
+	}
+
+	return NULL;
+}
+
+// cache_mutex held, < 0 when the url is cached or being fetched already
+static int fetch_begin(const char *key, int prefetch) {
+	char path[PATH_MAX];
+
+	cache_path(key, "", path, sizeof(path));
+	if ((access(path, F_OK) == 0) || fetch_find(key)
+			|| (nb_fetches == STREAM_MAX_FETCHES)) {
+		return -1;
+	}
+
+	av_strlcpy(fetches[nb_fetches].key, key, CACHE_KEY_SIZE);
+	fetches[nb_fetches].prefetch = prefetch;
+	nb_fetches++;
+	return 0;
+}
+
+// cache_mutex held, wakes the streams waiting for a prefetch
+static void fetch_end(const char *key) {
+	CacheFetch *f = fetch_find(key);
+
+	if (f) {
+		*f = fetches[--nb_fetches];
+	}
+	pthread_cond_broadcast(&cache_cond);
+}
+
+static int compare_entries(const void *a, const void *b) {
+	const CacheEntry *ea = (const CacheEntry*) a;
+	const CacheEntry *eb = (const CacheEntry*) b;
+
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+// cache_mutex held, oldest first until the cache fits
+static void cache_evict() {
+	char path[PATH_MAX];
+	CacheEntry *entries = NULL, *tmp;
+	int nb_entries = 0, max_entries = 0, i;
+	int64_t total = 0;
+	struct dirent *e;
+	struct stat st;
+	DIR *dir;
+
+	dir = opendir(cache_dir);
+	if (NULL == dir) {
+		return;
+	}
+
+	while ((e = readdir(dir)) != NULL) {
+		// finished files only, partial ones are being written
+		if (strlen(e->d_name) != CACHE_KEY_SIZE - 1) {
+			continue;
+		}
+		cache_path(e->d_name, "", path, sizeof(path));
+		if (stat(path, &st) < 0) {
+			continue;
+		}
+
+		if (nb_entries == max_entries) {
+			max_entries = max_entries ? 2 * max_entries : 64;
+			tmp = (CacheEntry*) av_realloc(entries,
+					max_entries * sizeof(CacheEntry));
+			if (NULL == tmp) {
+				break;
+			}
+			entries = tmp;
+		}
+		av_strlcpy(entries[nb_entries].key, e->d_name, CACHE_KEY_SIZE);
+		entries[nb_entries].mtime = st.st_mtime;
+		entries[nb_entries].size = st.st_size;
+		nb_entries++;
+		total += st.st_size;
+	}
+	closedir(dir);
+
+	qsort(entries, nb_entries, sizeof(CacheEntry), compare_entries);
+	for (i = 0; (i < nb_entries) && (total > cache_max_bytes); i++) {
+		cache_path(entries[i].key, "", path, sizeof(path));
+		if (unlink(path) == 0) {
+			total -= entries[i].size;
+		}
+	}
+
+	av_free(entries);
+}
+
+// the part file of key is complete, it becomes the cache file
+static void cache_commit(const char *key) {
+	char part[PATH_MAX], path[PATH_MAX];
+
+	pthread_mutex_lock(&cache_mutex);
+	cache_path(key, ".part", part, sizeof(part));
+	cache_path(key, "", path, sizeof(path));
+	if (rename(part, path) < 0) {
+		unlink(part);
+	}
+	fetch_end(key);
+	cache_evict();
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+static void cache_discard(const char *key) {
+	char part[PATH_MAX];
+
+	pthread_mutex_lock(&cache_mutex);
+	cache_path(key, ".part", part, sizeof(part));
+	unlink(part);
+	fetch_end(key);
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+// a process wide directory of at most max_bytes, NULL turns the cache off.
+// Prefetching writes to it, there is none without.
+int setStreamCache(const char *dir, int64_t max_bytes) {
+	char path[PATH_MAX];
+	struct dirent *e;
+	DIR *d;
+
+	if (dir && (max_bytes <= 0)) {
+		av_log(NULL, AV_LOG_ERROR, "setStreamCache : size out of range. \n");
+		return -1;
+	}
+
+	if (dir && (mkdir(dir, 0700) < 0) && (errno != EEXIST)) {
+		av_log(NULL, AV_LOG_ERROR, "setStreamCache : mkdir %s failure. \n",
+				dir);
+		return AVERROR(errno);
+	}
+
+	pthread_mutex_lock(&cache_mutex);
+	av_freep(&cache_dir);
+	cache_max_bytes = max_bytes;
+	if (dir) {
+		cache_dir = av_strdup(dir);
+	}
+
+	// partial files of an earlier process, not of a running fetch
+	d = cache_dir ? opendir(cache_dir) : NULL;
+	while (d && ((e = readdir(d)) != NULL)) {
+		if (strstr(e->d_name, ".part") && (0 == nb_fetches)) {
+			snprintf(path, sizeof(path), "%s/%s", cache_dir, e->d_name);
+			unlink(path);
+		}
+	}
+	if (d) {
+		closedir(d);
+		cache_evict();
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	return 0;
+}
+
+int stream_url(const char *url) {
+	return !strncmp(url, "http://", 7) || !strncmp(url, "https://", 8);
+}
+
+// rel against the playlist at base, the way players resolve HLS uris
+static char *resolve_url(const char *base, const char *rel) {
+	const char *end, *host;
+	int len;
+
+	if (strstr(rel, "://")) {
+		return av_strdup(rel);
+	}
+
+	if ('/' == rel[0]) {
+		host = strstr(base, "://");
+		end = host ? strchr(host + 3, '/') : NULL;
+		len = end ? (int) (end - base) : (int) strlen(base);
+	} else {
+		end = strchr(base, '?');
+		len = end ? (int) (end - base) : (int) strlen(base);
+		while ((len > 0) && (base[len - 1] != '/')) {
+			len--;
+		}
+	}
+
+	return av_asprintf("%.*s%s", len, base, rel);
+}
+
+static void playlist_free_segments(Playlist *p) {
+	int i;
+
+	for (i = 0; i < p->nb_segments; i++) {
+		av_free(p->segments[i]);
+	}
+	av_freep(&p->segments);
+	p->nb_segments = 0;
+}
+
+static int prefetch_interrupt_cb(void *opaque) {
+	return ((Prefetch*) opaque)->abort;
+}
+
+// prefetch->mutex held, the next segment wanted by any playlist
+static char *prefetch_next(Prefetch *prefetch) {
+	Playlist *p;
+	int i;
+
+	for (i = 0; i < prefetch->nb_playlists; i++) {
+		p = &prefetch->playlists[i];
+		if (p->next < p->end) {
+			return av_strdup(p->segments[p->next++]);
+		}
+	}
+
+	return NULL;
+}
+
+// downloads url into the cache unless it is there or on its way already
+static void prefetch_segment(Prefetch *prefetch, const char *url) {
+	AVIOInterruptCB cb = { prefetch_interrupt_cb, prefetch };
+	char key[CACHE_KEY_SIZE], part[PATH_MAX];
+	AVIOContext *pb = NULL;
+	uint8_t *buf;
+	int fd, size = 0, err;
+
+	cache_key(url, key);
+	pthread_mutex_lock(&cache_mutex);
+	err = cache_dir ? fetch_begin(key, 1) : -1;
+	cache_path(key, ".part", part, sizeof(part));
+	pthread_mutex_unlock(&cache_mutex);
+	if (err < 0) {
+		return;
+	}
+
+	buf = (uint8_t*) av_malloc(STREAM_BLOCK_SIZE);
+	fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	err = ((NULL == buf) || (fd < 0)) ? AVERROR(ENOMEM)
+			: avio_open2(&pb, url, AVIO_FLAG_READ, &cb, NULL);
+
+	while (err >= 0) {
+		size = avio_read(pb, buf, STREAM_BLOCK_SIZE);
+		if (size <= 0) {
+			break;
+		}
+		if (write(fd, buf, size) != size) {
+			err = AVERROR(EIO);
+		}
+	}
+
+	avio_closep(&pb);
+	if (fd >= 0) {
+		close(fd);
+	}
+	av_free(buf);
+
+	if ((err >= 0) && ((AVERROR_EOF == size) || (0 == size))) {
+		LOGV("prefetch_segment : %s cached.", url);
+		cache_commit(key);
+	} else {
+		cache_discard(key);
+	}
+}
+
+static void *prefetch_thread(void *argv) {
+	Prefetch *prefetch = (Prefetch*) argv;
+	char *url = NULL;
+
+	TRACE_THREAD("prefetch");
+
+	for (;;) {
+		pthread_mutex_lock(&prefetch->mutex);
+		while (!prefetch->abort && (NULL == (url = prefetch_next(prefetch)))) {
+			pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+		}
+		pthread_mutex_unlock(&prefetch->mutex);
+
+		if (prefetch->abort) {
+			av_free(url);
+			break;
+		}
+
+		prefetch_segment(prefetch, url);
+		av_free(url);
+	}
+
+	return NULL;
+}
+
+// the prefetch of player, started with its first media playlist. Only the
+// demuxer and the read ahead thread call this, one at a time.
+static Prefetch *prefetch_get(Player *player) {
+	Prefetch *prefetch = (Prefetch*) player->stream_priv;
+	int i;
+
+	if (prefetch || player->quit) {
+		return prefetch;
+	}
+
+	prefetch = (Prefetch*) av_mallocz(sizeof(Prefetch));
+	if (NULL == prefetch) {
+		return NULL;
+	}
+	pthread_mutex_init(&prefetch->mutex, NULL);
+	pthread_cond_init(&prefetch->cond, NULL);
+
+	for (i = 0; i < STREAM_PREFETCH_THREADS; i++) {
+		if (pthread_create(&prefetch->threads[i], NULL, prefetch_thread,
+				prefetch) != 0) {
+			av_log(NULL, AV_LOG_ERROR,
+					"prefetch_get : pthread_create failure. \n");
+			break;
+		}
+		prefetch->nb_threads++;
+	}
+
+	player->stream_priv = prefetch;
+	return prefetch;
+}
+
+// prefetch->mutex held, the segments after index i are wanted
+static void playlist_wants(Prefetch *prefetch, Playlist *p, int i) {
+	p->next = i;
+	p->end = FFMIN(i + STREAM_PREFETCH_SEGMENTS, p->nb_segments);
+	pthread_cond_broadcast(&prefetch->cond);
+}
+
+// the segments of a media playlist read by the demuxer, live ones are read
+// again and again
+static void prefetch_playlist(Player *player, const char *url, char *text) {
+	Prefetch *prefetch;
+	Playlist *p = NULL;
+	char **segments = NULL, **tmp, *line, *save = NULL, *segment;
+	int vod = strstr(text, "#EXT-X-ENDLIST") != NULL;
+	int nb_segments = 0, i;
+
+	// variants and byte ranges of one file are left to the demuxer
+	if (strstr(text, "#EXT-X-STREAM-INF") || strstr(text, "#EXT-X-BYTERANGE")) {
+		return;
+	}
+
+	for (line = strtok_r(text, "\r\n", &save); line;
+			line = strtok_r(NULL, "\r\n", &save)) {
+		while (' ' == *line) {
+			line++;
+		}
+		if (('\0' == *line) || ('#' == *line)) {
+			continue;
+		}
+
+		segment = resolve_url(url, line);
+		tmp = (char**) av_realloc(segments, (nb_segments + 1) * sizeof(char*));
+		if ((NULL == segment) || (NULL == tmp)) {
+			av_free(segment);
+			break;
+		}
+		segments = tmp;
+		segments[nb_segments++] = segment;
+	}
+
+	prefetch = cache_dir ? prefetch_get(player) : NULL;
+	if (NULL == prefetch) {
+		for (i = 0; i < nb_segments; i++) {
+			av_free(segments[i]);
+		}
+		av_free(segments);
+		return;
+	}
+
+	pthread_mutex_lock(&prefetch->mutex);
+	for (i = 0; i < prefetch->nb_playlists; i++) {
+		if (!strcmp(prefetch->playlists[i].url, url)) {
+			p = &prefetch->playlists[i];
+			playlist_free_segments(p);
+		}
+	}
+	if ((NULL == p) && (prefetch->nb_playlists < STREAM_MAX_PLAYLISTS)) {
+		p = &prefetch->playlists[prefetch->nb_playlists++];
+		p->url = av_strdup(url);
+	}
+	if (p) {
+		p->segments = segments;
+		p->nb_segments = nb_segments;
+		segments = NULL;
+		nb_segments = 0;
+
+		// a reload goes on after the segment playing, a vod starts at 0
+		for (i = 0; p->last_opened && (i < p->nb_segments); i++) {
+			if (!strcmp(p->segments[i], p->last_opened)) {
+				break;
+			}
+		}
+		if (p->last_opened && (i < p->nb_segments)) {
+			playlist_wants(prefetch, p, i + 1);
+		} else if (!p->last_opened && vod) {
+			playlist_wants(prefetch, p, 0);
+		} else {
+			p->next = p->end = 0;
+		}
+	}
+	pthread_mutex_unlock(&prefetch->mutex);
+
+	for (i = 0; i < nb_segments; i++) {
+		av_free(segments[i]);
+	}
+	av_free(segments);
+}
+
+// the demuxer opens url, prefetch the segments after it
+static void prefetch_opened(Player *player, const char *url) {
+	Prefetch *prefetch = (Prefetch*) player->stream_priv;
+	Playlist *p;
+	int i, j;
+
+	if (NULL == prefetch) {
+		return;
+	}
+
+	pthread_mutex_lock(&prefetch->mutex);
+	for (i = 0; i < prefetch->nb_playlists; i++) {
+		p = &prefetch->playlists[i];
+		for (j = 0; j < p->nb_segments; j++) {
+			if (!strcmp(p->segments[j], url)) {
+				av_free(p->last_opened);
+				p->last_opened = av_strdup(url);
+				playlist_wants(prefetch, p, j + 1);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&prefetch->mutex);
+}
+
+static int stream_interrupt_cb(void *opaque) {
+	return ((HttpStream*) opaque)->player->quit;
+}
+
+// stop copying to the cache, the stream is not read straight to its end
+static void stream_abandon(HttpStream *s) {
+	if (s->writing) {
+		close(s->fd);
+		s->fd = -1;
+		s->writing = 0;
+		cache_discard(s->key);
+	}
+}
+
+// an HLS playlist is only cached when it never changes
+static int stream_cacheable(HttpStream *s) {
+	return !s->is_playlist || (s->playlist && (strstr(s->playlist,
+			"#EXT-X-ENDLIST") || strstr(s->playlist, "#EXT-X-STREAM-INF")));
+}
+
+static void stream_eof(HttpStream *s) {
+	if (s->writing) {
+		if (stream_cacheable(s)) {
+			close(s->fd);
+			s->fd = -1;
+			s->writing = 0;
+			cache_commit(s->key);
+		} else {
+			stream_abandon(s);
+		}
+	}
+
+	if (s->is_playlist && s->playlist) {
+		prefetch_playlist(s->player, s->url, s->playlist);
+		av_freep(&s->playlist);
+		s->is_playlist = 0;
+	}
+}
+
+// keeps the text of an HLS playlist, it starts with #EXTM3U
+static void stream_capture(HttpStream *s, const uint8_t *buf, int size) {
+	char *tmp;
+
+	if ((0 == s->pos) && (size >= 7) && !memcmp(buf, "#EXTM3U", 7)) {
+		s->is_playlist = 1;
+	}
+	if (!s->is_playlist) {
+		return;
+	}
+
+	tmp = (char*) av_realloc(s->playlist, s->playlist_size + size + 1);
+	if ((NULL == tmp) || (s->playlist_size + size > STREAM_MAX_PLAYLIST)) {
+		av_freep(&s->playlist);
+		s->is_playlist = 0;
+		return;
+	}
+	s->playlist = tmp;
+	memcpy(s->playlist + s->playlist_size, buf, size);
+	s->playlist_size += size;
+	s->playlist[s->playlist_size] = '\0';
+}
+
+int stream_read(void *opaque, uint8_t *buf, int buf_size) {
+	HttpStream *s = (HttpStream*) opaque;
+	ssize_t size;
+
+	if (NULL == s->pb) {
+		do {
+			size = read(s->fd, buf, buf_size);
+		} while ((size < 0) && (EINTR == errno));
+		if (size < 0) {
+			return AVERROR(errno);
+		}
+	} else {
+		size = avio_read(s->pb, buf, buf_size);
+		if (size < 0) {
+			if (size != AVERROR_EOF) {
+				stream_abandon(s);
+				return (int) size;
+			}
+			size = 0;
+		}
+		if (s->writing && ((write(s->fd, buf, size) != size)
+				|| (s->pos + size > cache_max_bytes))) {
+			stream_abandon(s);
+		}
+	}
+
+	if (0 == size) {
+		stream_eof(s);
+		return AVERROR_EOF;
+	}
+
+	stream_capture(s, buf, (int) size);
+	s->pos += size;
+	return (int) size;
+}
+
+int64_t stream_seek(void *opaque, int64_t offset, int whence) {
+	HttpStream *s = (HttpStream*) opaque;
+	int64_t pos;
+
+	whence &= ~AVSEEK_FORCE;
+	if (AVSEEK_SIZE == whence) {
+		return s->pb ? avio_size(s->pb) : s->size;
+	}
+
+	if (NULL == s->pb) {
+		pos = lseek(s->fd, offset, whence);
+		if (pos < 0) {
+			return AVERROR(errno);
+		}
+	} else {
+		if (SEEK_CUR == whence) {
+			offset += s->pos;
+		} else if (SEEK_END == whence) {
+			offset += avio_size(s->pb);
+		}
+		pos = avio_seek(s->pb, offset, SEEK_SET);
+		if (pos < 0) {
+			return pos;
+		}
+	}
+
+	// the cache and the playlist parser want every byte in order
+	if (pos != s->pos) {
+		stream_abandon(s);
+		av_freep(&s->playlist);
+		s->is_playlist = 0;
+	}
+
+	s->pos = pos;
+	return pos;
+}
+
+void stream_close(void *opaque) {
+	HttpStream *s = (HttpStream*) opaque;
+
+	stream_abandon(s);
+	avio_closep(&s->pb);
+	if (s->fd >= 0) {
+		close(s->fd);
+	}
+	av_free(s->playlist);
+	av_free(s->url);
+	av_free(s);
+}
+
+// url from the cache, after a prefetch of it when one runs, or from the
+// network, copied to the cache meanwhile. options as for avio_open2().
+int open_stream(Player *player, const char *url, AVDictionary **options,
+		void **stream) {
+	AVIOInterruptCB cb;
+	HttpStream *s;
+	char path[PATH_MAX];
+	CacheFetch *f;
+	struct stat st;
+	int ranged, err;
+
+	s = (HttpStream*) av_mallocz(sizeof(HttpStream));
+	if ((NULL == s) || (NULL == (s->url = av_strdup(url)))) {
+		av_free(s);
+		return AVERROR(ENOMEM);
+	}
+	s->player = player;
+	s->fd = -1;
+
+	// HLS byte ranges of a file are not cached
+	ranged = options && (av_dict_get(*options, "offset", NULL, 0)
+			|| av_dict_get(*options, "end_offset", NULL, 0));
+
+	pthread_mutex_lock(&cache_mutex);
+	if (cache_dir && !ranged) {
+		cache_key(url, s->key);
+		while (!player->quit && (f = fetch_find(s->key)) && f->prefetch) {
+			pthread_cond_wait(&cache_cond, &cache_mutex);
+		}
+
+		cache_path(s->key, "", path, sizeof(path));
+		s->fd = open(path, O_RDONLY);
+		if (s->fd >= 0) {
+			// the mtime orders the eviction
+			utime(path, NULL);
+		} else if (fetch_begin(s->key, 0) == 0) {
+			s->writing = 1;
+		}
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	if (s->fd >= 0) {
+		s->size = (fstat(s->fd, &st) == 0) ? st.st_size : -1;
+		metrics_count(&player->metrics, METRIC_CACHE_HITS);
+		LOGV("open_stream : %s from the cache.", url);
+		*stream = s;
+		return 0;
+	}
+
+	cb.callback = stream_interrupt_cb;
+	cb.opaque = s;
+	err = avio_open2(&s->pb, url, AVIO_FLAG_READ, &cb, options);
+	if (err < 0) {
+		av_log(NULL, AV_LOG_ERROR, "open_stream : %s, err is %d \n", url, err);
+		stream_close(s);
+		return err;
+	}
+	metrics_count(&player->metrics, METRIC_CACHE_MISSES);
+
+	if (s->writing) {
+		cache_path(s->key, ".part", path, sizeof(path));
+		s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (s->fd < 0) {
+			s->writing = 0;
+			cache_discard(s->key);
+		}
+	}
+
+	*stream = s;
+	return 0;
+}
+
+// AVFormatContext.io_open, for what the demuxer opens itself: the segments
+// and playlists of HLS
+int stream_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+		int flags, AVDictionary **options) {
+	Player *player = (Player*) s->opaque;
+	HttpStream *stream;
+	uint8_t *buffer;
+	int err;
+
+	if ((flags & AVIO_FLAG_WRITE) || !stream_url(url)) {
+		return avio_open2(pb, url, flags, &s->interrupt_callback, options);
+	}
+
+	prefetch_opened(player, url);
+	if ((err = open_stream(player, url, options, (void**) &stream)) < 0) {
+		return err;
+	}
+
+	buffer = (uint8_t*) av_malloc(STREAM_BUFFER_SIZE);
+	*pb = buffer ? avio_alloc_context(buffer, STREAM_BUFFER_SIZE, 0, stream,
+			stream_read, NULL, stream_seek) : NULL;
+	if (NULL == *pb) {
+		av_free(buffer);
+		stream_close(stream);
+		return AVERROR(ENOMEM);
+	}
+	if (stream->pb) {
+		(*pb)->seekable = stream->pb->seekable;
+	}
+
+	return 0;
+}
+
+void stream_io_close(AVFormatContext *s, AVIOContext *pb) {
+	if (pb->read_packet != stream_read) {
+		avio_close(pb);
+		return;
+	}
+
+	stream_close(pb->opaque);
+	av_freep(&pb->buffer);
+	av_free(pb);
+}
+
+// stopPlayer() must not wait for a download or for a stream waiting on one
+void stream_abort(Player *player) {
+	Prefetch *prefetch = (Prefetch*) player->stream_priv;
+
+	if (prefetch) {
+		pthread_mutex_lock(&prefetch->mutex);
+		prefetch->abort = 1;
+		pthread_cond_broadcast(&prefetch->cond);
+		pthread_mutex_unlock(&prefetch->mutex);
+	}
+
+	pthread_mutex_lock(&cache_mutex);
+	pthread_cond_broadcast(&cache_cond);
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+// after the demuxer closed its streams
+void stream_stop(Player *player) {
+	Prefetch *prefetch = (Prefetch*) player->stream_priv;
+	Playlist *p;
+	int i;
+
+	if (NULL == prefetch) {
+		return;
+	}
+
+	stream_abort(player);
+	for (i = 0; i < prefetch->nb_threads; i++) {
+		pthread_join(prefetch->threads[i], NULL);
+	}
+
+	for (i = 0; i < prefetch->nb_playlists; i++) {
+		p = &prefetch->playlists[i];
+		playlist_free_segments(p);
+		av_free(p->url);
+		av_free(p->last_opened);
+	}
+	pthread_mutex_destroy(&prefetch->mutex);
+	pthread_cond_destroy(&prefetch->cond);
+	av_free(prefetch);
+	player->stream_priv = NULL;
+}
@@ -6,57 +6,51 @@
 
 #include "player.h"
 
-static ANativeWindow* mANativeWindow;
-static ANativeWindow_Buffer nwBuffer;
 static jclass globalVideoSurfaceClass = NULL;
-static jobject globalVideoSurfaceObject = NULL;
+// for events from the player threads
+static JavaVM *javaVM;
+static jmethodID onNativeBufferingMethod;
 
+// players share the display, the last one terminates it
+static int eglDisplayRefs;
+static pthread_mutex_t eglDisplayMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
-void renderSurface(AVFrame *frame) {
-
-	if (global_context.quit) {
-		glDisable(GL_TEXTURE_2D);
-		glDeleteTextures(3, global_context.mTextureID);
-		glDeleteProgram(global_context.glProgram);
-		return;
-	}
-
-	if (global_context.pause) {
-		return;
-	}
-
-	Render(frame);
-}
 
 // format not used now.
-int32_t setBuffersGeometry(int32_t width, int32_t height) {
+int32_t setBuffersGeometry(Player *player, int32_t width, int32_t height) {
 	//int32_t format = WINDOW_FORMAT_RGB_565;
 
-	if (NULL == mANativeWindow) {
-		LOGV("mANativeWindow is NULL.");
+	if (NULL == player->native_window) {
+		LOGE("native_window is NULL.");
 		return -1;
 	}
 
-	return ANativeWindow_setBuffersGeometry(mANativeWindow, width, height,
-			global_context.eglFormat);
+	return ANativeWindow_setBuffersGeometry(player->native_window, width,
+			height, player->eglFormat);
 }
 
-int eglOpen() {
+static int eglOpen(Player *player) {
 	EGLDisplay eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY );
 	if (eglDisplay == EGL_NO_DISPLAY ) {
-		LOGV("eglGetDisplay failure.");
+		LOGE("eglGetDisplay failure.");
 		return -1;
 	}
-	global_context.eglDisplay = eglDisplay;
+	player->eglDisplay = eglDisplay;
 	LOGV("eglGetDisplay ok");
 
 	EGLint majorVersion;
 	EGLint minorVersion;
+	pthread_mutex_lock(&eglDisplayMutex);
 	EGLBoolean success = eglInitialize(eglDisplay, &majorVersion,
 			&minorVersion);
+	if (success) {
+		eglDisplayRefs++;
+	}
+	pthread_mutex_unlock(&eglDisplayMutex);
 	if (!success) {
-		LOGV("eglInitialize failure.");
+		LOGE("eglInitialize failure.");
+		player->eglDisplay = NULL;
 		return -1;
 	}
 	LOGV("eglInitialize ok");
@@ -72,7 +66,7 @@ int eglOpen() {
 	success = eglChooseConfig(eglDisplay, CONFIG_ATTRIBS, &config, 1,
 			&numConfigs);
 	if (!success) {
-		LOGV("eglChooseConfig failure.");
+		LOGE("eglChooseConfig failure.");
 		return -1;
 	}
 	LOGV("eglChooseConfig ok");
@@ -81,110 +75,259 @@ int eglOpen() {
 	EGLContext elgContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT,
 			attribs);
 	if (elgContext == EGL_NO_CONTEXT ) {
-		LOGV("eglCreateContext failure, error is %d", eglGetError());
+		LOGE("eglCreateContext failure, error is %d", eglGetError());
 		return -1;
 	}
-	global_context.eglContext = elgContext;
+	player->eglContext = elgContext;
 	LOGV("eglCreateContext ok");
 
 	EGLint eglFormat;
 	success = eglGetConfigAttrib(eglDisplay, config, EGL_NATIVE_VISUAL_ID,
 			&eglFormat);
 	if (!success) {
-		LOGV("eglGetConfigAttrib failure.");
+		LOGE("eglGetConfigAttrib failure.");
 		return -1;
 	}
-	global_context.eglFormat = eglFormat;
+	player->eglFormat = eglFormat;
 	LOGV("eglGetConfigAttrib ok");
 
 	EGLSurface eglSurface = eglCreateWindowSurface(eglDisplay, config,
-			mANativeWindow, 0);
+			player->native_window, 0);
 	if (NULL == eglSurface) {
-		LOGV("eglCreateWindowSurface failure.");
+		LOGE("eglCreateWindowSurface failure.");
 		return -1;
 	}
-	global_context.eglSurface = eglSurface;
+	player->eglSurface = eglSurface;
 	LOGV("eglCreateWindowSurface ok");
 	return 0;
 }
 
-int eglClose() {
-	EGLBoolean success = eglDestroySurface(global_context.eglDisplay,
-			global_context.eglSurface);
-	if (!success) {
-		LOGV("eglDestroySurface failure.");
+int eglClose(Player *player) {
+	if (NULL == player->eglDisplay) {
+		return 0;
 	}
 
-	success = eglDestroyContext(global_context.eglDisplay,
-			global_context.eglContext);
+	EGLBoolean success = eglDestroySurface(player->eglDisplay,
+			player->eglSurface);
 	if (!success) {
-		LOGV("eglDestroySurface failure.");
+		LOGE("eglDestroySurface failure.");
 	}
 
-	success = eglTerminate(global_context.eglDisplay);
+	success = eglDestroyContext(player->eglDisplay,
+			player->eglContext);
 	if (!success) {
-		LOGV("eglDestroySurface failure.");
+		LOGE("eglDestroySurface failure.");
+	}
+
+	pthread_mutex_lock(&eglDisplayMutex);
+	if (--eglDisplayRefs == 0) {
+		success = eglTerminate(player->eglDisplay);
+		if (!success) {
+			LOGE("eglDestroySurface failure.");
+		}
 	}
+	pthread_mutex_unlock(&eglDisplayMutex);
 
-	global_context.eglSurface = NULL;
-	global_context.eglContext = NULL;
-	global_context.eglDisplay = NULL;
+	player->eglSurface = NULL;
+	player->eglContext = NULL;
+	player->eglDisplay = NULL;
 
 	return 0;
 }
 
-int setNativeSurface(JNIEnv *env, jobject obj, jobject surface) {
-	pthread_t thread_1;
+// on the render thread, egl of the window is made current there
+static int gl_bind(Player *player, int width, int height) {
+	if ((width > 0) && (height > 0)) {
+		setBuffersGeometry(player, width, height);
+	}
 
-	//LOGV("fun env is %p", env);
+	if (!eglMakeCurrent(player->eglDisplay, player->eglSurface,
+			player->eglSurface, player->eglContext)) {
+		LOGE("eglMakeCurrent failure.");
+		return -1;
+	}
 
-	jclass localVideoSurfaceClass = env->FindClass(
-			"com/ffmpeg/avsync/VideoSurface");
-	if (NULL == localVideoSurfaceClass) {
-		LOGV("FindClass VideoSurface failure.");
+	return CreateProgram(player);
+}
+
+// the window may come later, gl_attach() binds it then
+static int gl_open(Player *player, int width, int height) {
+	if (NULL == player->eglDisplay) {
+		return 0;
+	}
+
+	return gl_bind(player, width, height);
+}
+
+static void gl_display(Player *player, AVFrame *frame) {
+	if (NULL == player->eglSurface) {
+		return;
+	}
+
+	Render(player, frame);
+}
+
+// on the render thread, the context is released where it is current
+static void gl_close(Player *player) {
+	if (NULL == player->eglDisplay) {
+		return;
+	}
+
+	if (player->picture_running) {
+		glDisable(GL_TEXTURE_2D);
+		glDeleteTextures(3, player->mTextureID);
+		glDeleteProgram(player->glProgram);
+
+		eglMakeCurrent(player->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+				EGL_NO_CONTEXT);
+	}
+	eglClose(player);
+}
+
+// egl on the new native_window. Bound right away on the render thread,
+// otherwise gl_open() does it when the render thread starts.
+static int gl_attach(Player *player) {
+	if ((NULL == player->native_window) || player->eglDisplay) {
+		return 0;
+	}
+
+	if (eglOpen(player) < 0) {
+		eglClose(player);
 		return -1;
 	}
 
-	globalVideoSurfaceClass = (jclass) env->NewGlobalRef(
-			localVideoSurfaceClass);
+	if (!player->picture_running) {
+		return 0;
+	}
+	return gl_bind(player, player->vcodec_ctx->width,
+			player->vcodec_ctx->height);
+}
+
+// the surface is going, nothing may render to its window after this
+static void gl_detach(Player *player) {
+	gl_close(player);
+
+	if (player->native_window) {
+		ANativeWindow_release(player->native_window);
+		player->native_window = NULL;
+	}
+}
+
+VideoSink gl_video_sink = { "gl", gl_open, gl_display, gl_close, gl_attach,
+		gl_detach };
+
+// attach the surface, playing starts once the source is set too. A NULL
+// surface holds playback and lets the window go, until a new surface is set.
+int setNativeSurface(Player *player, JNIEnv *env, jobject obj,
+		jobject surface) {
+	ANativeWindow *window;
+
 	if (NULL == globalVideoSurfaceClass) {
-		LOGV("localVideoSurfaceClass to globalVideoSurfaceClass failure.");
+		jclass localVideoSurfaceClass = env->FindClass(
+				"com/ffmpeg/avsync/VideoSurface");
+		if (NULL == localVideoSurfaceClass) {
+			LOGE("FindClass VideoSurface failure.");
+			return -1;
+		}
+
+		globalVideoSurfaceClass = (jclass) env->NewGlobalRef(
+				localVideoSurfaceClass);
+		if (NULL == globalVideoSurfaceClass) {
+			LOGE("localVideoSurfaceClass to globalVideoSurfaceClass failure.");
+		}
+
+		env->GetJavaVM(&javaVM);
+		onNativeBufferingMethod = env->GetMethodID(localVideoSurfaceClass,
+				"onNativeBuffering", "(ZII)V");
 	}
 
-	globalVideoSurfaceObject = (jclass) env->NewGlobalRef(obj);
-	if (NULL == globalVideoSurfaceObject) {
-		LOGV("obj to globalVideoSurfaceObject failure.");
+	if (NULL == player->surface_object) {
+		player->surface_object = env->NewGlobalRef(obj);
+		if (NULL == player->surface_object) {
+			LOGE("obj to surface_object failure.");
+		}
 	}
 
 	if (NULL == surface) {
-		LOGV("surface is null, destroy?");
-		mANativeWindow = NULL;
+		LOGV("setNativeSurface : surface destroyed, playback held.");
+		if (player->started && !player->pause) {
+			pausePlayer(player);
+			player->surface_paused = 1;
+		}
+		video_sink_request(player, VIDEO_SINK_DETACH);
 		return 0;
 	}
 
 	// obtain a native window from a Java surface
-	mANativeWindow = ANativeWindow_fromSurface(env, surface);
-	LOGV("mANativeWindow ok");
+	window = ANativeWindow_fromSurface(env, surface);
+	if (NULL == window) {
+		LOGE("ANativeWindow_fromSurface failure.");
+		return -1;
+	}
+	LOGV("native_window ok");
 
-	if ((global_context.eglSurface != NULL)
-			|| (global_context.eglContext != NULL)
-			|| (global_context.eglDisplay != NULL)) {
-		eglClose();
+	// set twice without a destroy, the old window goes first
+	video_sink_request(player, VIDEO_SINK_DETACH);
+
+	// the render thread does not touch the window while detached
+	pthread_mutex_lock(&player->timer_mutex);
+	player->native_window = window;
+	pthread_mutex_unlock(&player->timer_mutex);
+	video_sink_request(player, VIDEO_SINK_ATTACH);
+
+	if (player->surface_paused) {
+		player->surface_paused = 0;
+		resumePlayer(player);
 	}
 
-	memset(global_context.pictq, 0,
-			VIDEO_PICTURE_QUEUE_SIZE * sizeof(VideoPicture));
-	//timer_deinit();
-	global_context.pictq_rindex = 0;
-	global_context.pictq_windex = 0;
-	global_context.pictq_size = 0;
-	global_context.quit = 0;
-	global_context.pause = 0;
+	if (player->started || (SOURCE_NONE == player->source.type)) {
+		return 0;
+	}
+	return startPlayer(player);
+}
 
-	eglOpen();
+// Player.notify, to the VideoSurface from whichever player thread it comes.
+// Threads of the pool are attached for the call only.
+void notifyVideoSurface(Player *player, int event, int arg1, int arg2) {
+	JNIEnv *env;
+	int attached = 0;
 
-	pthread_create(&thread_1, NULL, open_media, NULL);
+	if ((NULL == javaVM) || (NULL == player->surface_object)
+			|| (NULL == onNativeBufferingMethod)) {
+		return;
+	}
 
-	return 0;
+	if (javaVM->GetEnv((void**) &env, JNI_VERSION_1_4) != JNI_OK) {
+		if (javaVM->AttachCurrentThread(&env, NULL) != JNI_OK) {
+			LOGE("notifyVideoSurface : AttachCurrentThread failure.");
+			return;
+		}
+		attached = 1;
+	}
+
+	switch (event) {
+	case PLAYER_EVENT_BUFFERING_START:
+	case PLAYER_EVENT_BUFFERING_END:
+		env->CallVoidMethod(player->surface_object, onNativeBufferingMethod,
+				(jboolean) (PLAYER_EVENT_BUFFERING_START == event), arg1, arg2);
+		break;
+	}
+	if (env->ExceptionCheck()) {
+		env->ExceptionClear();
+	}
+
+	if (attached) {
+		javaVM->DetachCurrentThread();
+	}
 }
 
+// egl and the window of the player, once picture_thread is done
+void releaseNativeSurface(Player *player) {
+	// already closed by the render thread, unless it never started
+	eglClose(player);
+
+	if (player->native_window) {
+		ANativeWindow_release(player->native_window);
+		player->native_window = NULL;
+	}
+}
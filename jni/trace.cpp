@@ -0,0 +1,167 @@
+#include "player.h"
+
+#ifdef AVSYNC_TRACE
+
+#include <unistd.h>
+
+#include "libavutil/bprint.h"
+
+/*
+ * Every thread writes its events into its own ring, so recording takes no
+ * lock. A ring is claimed on the first event of a thread and handed back
+ * when the thread exits, its events stay readable until it is claimed again.
+ */
+
+#define TRACE_MAX_THREADS 16
+#define TRACE_BUFFER_EVENTS 4096
+
+typedef struct TraceEvent {
+	const char *name;
+	int64_t ts;
+	char phase;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+	int in_use;
+	pid_t tid;
+	const char *thread_name;
+	uint32_t head;             // events written so far, the ring wraps
+	TraceEvent *events;
+} TraceBuffer;
+
+static TraceBuffer trace_buffers[TRACE_MAX_THREADS];
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static void trace_release(void *opaque) {
+	TraceBuffer *buf = (TraceBuffer*) opaque;
+
+	__sync_synchronize();
+	buf->in_use = 0;
+}
+
+static void trace_init() {
+	pthread_key_create(&trace_key, trace_release);
+}
+
+static TraceBuffer *trace_get_buffer() {
+	TraceBuffer *buf;
+	int i;
+
+	pthread_once(&trace_once, trace_init);
+
+	buf = (TraceBuffer*) pthread_getspecific(trace_key);
+	if (buf) {
+		return buf;
+	}
+
+	for (i = 0; i < TRACE_MAX_THREADS; i++) {
+		buf = &trace_buffers[i];
+		if (!__sync_bool_compare_and_swap(&buf->in_use, 0, 1)) {
+			continue;
+		}
+
+		if (NULL == buf->events) {
+			buf->events = (TraceEvent*) av_mallocz(
+					TRACE_BUFFER_EVENTS * sizeof(TraceEvent));
+			if (NULL == buf->events) {
+				buf->in_use = 0;
+				return NULL;
+			}
+		}
+		buf->tid = syscall(__NR_gettid);
+		buf->thread_name = NULL;
+		buf->head = 0;
+
+		pthread_setspecific(trace_key, buf);
+		return buf;
+	}
+
+	// more threads than rings, this one is not traced
+	return NULL;
+}
+
+void trace_event(const char *name, char phase) {
+	TraceBuffer *buf = trace_get_buffer();
+	TraceEvent *ev;
+
+	if (NULL == buf) {
+		return;
+	}
+
+	ev = &buf->events[buf->head % TRACE_BUFFER_EVENTS];
+	ev->name = name;
+	ev->ts = av_gettime_relative();
+	ev->phase = phase;
+
+	// publish the event after it is complete
+	__sync_synchronize();
+	buf->head++;
+}
+
+void trace_thread_name(const char *name) {
+	TraceBuffer *buf = trace_get_buffer();
+
+	if (buf) {
+		buf->thread_name = name;
+	}
+}
+
+// chrome trace event format, open it in chrome://tracing
+char *trace_dump() {
+	AVBPrint bp;
+	TraceBuffer *buf;
+	TraceEvent *ev;
+	uint32_t head, first, n;
+	pid_t pid = getpid();
+	int i, sep = 0;
+	char *json;
+
+	av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+	av_bprintf(&bp, "{\"traceEvents\":[");
+
+	for (i = 0; i < TRACE_MAX_THREADS; i++) {
+		buf = &trace_buffers[i];
+		if (NULL == buf->events) {
+			continue;
+		}
+
+		head = buf->head;
+		__sync_synchronize();
+		first = (head > TRACE_BUFFER_EVENTS) ? head - TRACE_BUFFER_EVENTS : 0;
+
+		if (buf->thread_name) {
+			av_bprintf(&bp,
+					"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+							"\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+					sep ? "," : "", pid, buf->tid, buf->thread_name);
+			sep = 1;
+		}
+
+		for (n = first; n < head; n++) {
+			ev = &buf->events[n % TRACE_BUFFER_EVENTS];
+			av_bprintf(&bp,
+					"%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64
+					",\"pid\":%d,\"tid\":%d}", sep ? "," : "", ev->name,
+					ev->phase, ev->ts, pid, buf->tid);
+			sep = 1;
+		}
+	}
+
+	av_bprintf(&bp, "]}");
+
+	if (av_bprint_finalize(&bp, &json) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "trace_dump : out of memory. \n");
+		return NULL;
+	}
+	return json;
+}
+
+#else
+
+// tracing is compiled out, there is nothing to dump
+char *trace_dump() {
+	return NULL;
+}
+
+#endif
@@ -1,8 +1,50 @@
 #include "player.h"
 
+// runtime minimum level of each log category, see AVSYNC_LOG
+int log_levels[LOG_CATEGORY_NB] = { ANDROID_LOG_VERBOSE, ANDROID_LOG_VERBOSE,
+		ANDROID_LOG_VERBOSE };
+
+int setLogLevel(int category, int level) {
+	if ((category < 0) || (category >= LOG_CATEGORY_NB)) {
+		av_log(NULL, AV_LOG_ERROR, "setLogLevel : unknown category %d. \n",
+				category);
+		return -1;
+	}
+
+	log_levels[category] = level;
+	return 0;
+}
+
 void packet_queue_init(PacketQueue *q) {
 	memset(q, 0, sizeof(PacketQueue));
 	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+// wake every thread blocked in packet_queue_get(), they return -1
+void packet_queue_abort(PacketQueue *q) {
+	pthread_mutex_lock(&q->mutex);
+	q->abort_request = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+// free the packets left in the queue
+void packet_queue_flush(PacketQueue *q) {
+	AVPacketList *pkt, *pkt1;
+
+	pthread_mutex_lock(&q->mutex);
+	for (pkt = q->first_pkt; pkt; pkt = pkt1) {
+		pkt1 = pkt->next;
+		av_packet_unref(&pkt->pkt);
+		av_free(pkt);
+	}
+	q->first_pkt = NULL;
+	q->last_pkt = NULL;
+	q->nb_packets = 0;
+	q->size = 0;
+	q->duration = 0;
+	pthread_mutex_unlock(&q->mutex);
 }
 
 int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
@@ -28,6 +70,7 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
 	pkt1->pkt = *pkt;
 	pkt1->next = NULL;
 
+	TRACE_BEGIN("packet_put");
 	pthread_mutex_lock(&q->mutex);
 
 	if (!q->last_pkt) {
@@ -39,41 +82,66 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
 	q->last_pkt = pkt1;
 	q->nb_packets++;
 	q->size += pkt1->pkt.size;
+	q->duration += pkt1->pkt.duration;
 
+	pthread_cond_signal(&q->cond);
 	pthread_mutex_unlock(&q->mutex);
+	TRACE_END("packet_put");
 
 	return 0;
 }
 
-int packet_queue_get(PacketQueue *q, AVPacket *pkt) {
-	AVPacketList *pkt1;
-	int ret;
+// an empty packet tells the decoder to drain at end of stream
+int packet_queue_put_nullpacket(PacketQueue *q) {
+	AVPacket pkt1, *pkt = &pkt1;
 
-	if (global_context.quit) {
-		return -1;
-	}
+	av_init_packet(pkt);
+	pkt->data = NULL;
+	pkt->size = 0;
 
-	pthread_mutex_lock(&q->mutex);
+	return packet_queue_put(q, pkt);
+}
 
-	pkt1 = q->first_pkt;
+/* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block) {
+	AVPacketList *pkt1;
+	int ret;
 
-	if (pkt1) {
-		q->first_pkt = pkt1->next;
+	TRACE_BEGIN("packet_get");
+	pthread_mutex_lock(&q->mutex);
 
-		if (!q->first_pkt) {
-			q->last_pkt = NULL;
+	for (;;) {
+		if (q->abort_request) {
+			ret = -1;
+			break;
 		}
 
-		q->nb_packets--;
-		q->size -= pkt1->pkt.size;
-		*pkt = pkt1->pkt;
-		av_free(pkt1);
-		ret = 1;
-	} else {
-		ret = 0;
+		pkt1 = q->first_pkt;
+
+		if (pkt1) {
+			q->first_pkt = pkt1->next;
+
+			if (!q->first_pkt) {
+				q->last_pkt = NULL;
+			}
+
+			q->nb_packets--;
+			q->size -= pkt1->pkt.size;
+			q->duration -= pkt1->pkt.duration;
+			*pkt = pkt1->pkt;
+			av_free(pkt1);
+			ret = 1;
+			break;
+		} else if (!block) {
+			ret = 0;
+			break;
+		} else {
+			pthread_cond_wait(&q->cond, &q->mutex);
+		}
 	}
 
 	pthread_mutex_unlock(&q->mutex);
+	TRACE_END("packet_get");
 
 	return ret;
 }
@@ -82,3 +150,40 @@ int packet_queue_size(PacketQueue *q) {
 	return q->size;
 }
 
+
+// undo the wrap of timestamps limited to pts_wrap_bits, e.g. 33 bits in
+// MPEG-TS, by keeping each one within half a wrap of the previous one
+static int64_t unwrap_timestamp(AVStream *st, int64_t ts, int64_t *last_ts) {
+	int64_t wrap, half;
+
+	if ((ts == AV_NOPTS_VALUE) || (st->pts_wrap_bits <= 0)
+			|| (st->pts_wrap_bits >= 63)) {
+		return ts;
+	}
+
+	wrap = 1LL << st->pts_wrap_bits;
+	half = wrap >> 1;
+
+	if (*last_ts != AV_NOPTS_VALUE) {
+		while (ts < *last_ts - half) {
+			ts += wrap;
+		}
+		while (ts > *last_ts + half) {
+			ts -= wrap;
+		}
+	}
+
+	*last_ts = ts;
+	return ts;
+}
+
+// stream timestamp to seconds from the start of the media, NAN if unknown
+double stream_timestamp_to_seconds(Player *player, AVStream *st, int64_t ts,
+		int64_t *last_ts) {
+	ts = unwrap_timestamp(st, ts, last_ts);
+	if (ts == AV_NOPTS_VALUE) {
+		return NAN;
+	}
+
+	return ts * av_q2d(st->time_base) - player->start_time;
+}
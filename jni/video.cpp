@@ -1,230 +1,520 @@
 #include "player.h"
 
 #define AV_SYNC_THRESHOLD 0.1
-/* no AV correction is done if too big error */
-#define AV_NOSYNC_THRESHOLD 10.0
 /* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
 #define AUDIO_DIFF_AVG_NB   20
 /* maximum audio speed change to get correct sync */
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
+/* above this playback rate non reference frames are not decoded */
+#define VIDEO_SKIP_NONREF_RATE 2.0
+/* this many late pictures in a row make the decoder skip non reference frames */
+#define VIDEO_LATE_STREAK_NONREF 5
+/* frames or packets handled per run of the video task */
+#define VIDEO_SLICE_STEPS 8
+
+// a packet sent while non reference frames are skipped, the oldest one is
+// forgotten when too many are tracked
+static void skip_track_packet(Player *player, AVPacket *packet) {
+	if ((AV_NOPTS_VALUE == packet->pts)
+			|| (AVDISCARD_DEFAULT == player->vcodec_ctx->skip_frame)) {
+		return;
+	}
 
-static double video_clock;
-static double video_current_pts;
-
-static int timer_delay_ms = 0;
+	if (player->skip_track_count >= VIDEO_SKIP_TRACK_MAX) {
+		memmove(&player->skip_track_pts[0], &player->skip_track_pts[1],
+				(VIDEO_SKIP_TRACK_MAX - 1) * sizeof(int64_t));
+		player->skip_track_count--;
+	}
+	player->skip_track_pts[player->skip_track_count++] = packet->pts;
+}
 
+// frames come out in pts order, so a tracked packet before this frame will
+// never give one: the decoder discarded it. At the end every one left was.
+static void skip_track_frame(Player *player, int64_t pts) {
+	int i, n = 0;
 
-double get_video_clock() {
-	double delta = (av_gettime() - global_context.video_current_pts_time)
-			/ 1000000.0;
-	return video_current_pts + delta;
+	for (i = 0; i < player->skip_track_count; i++) {
+		if ((AV_NOPTS_VALUE == pts) || (player->skip_track_pts[i] < pts)) {
+			metrics_count(&player->metrics, METRIC_FRAMES_DROPPED_EARLY);
+		} else if (player->skip_track_pts[i] > pts) {
+			player->skip_track_pts[n++] = player->skip_track_pts[i];
+		}
+	}
+	player->skip_track_count = n;
 }
 
-static double synchronize_video(AVFrame *pFrame, double pts) {
-	double time_base;
-	double frame_delay = 0;
+// pts is NAN when the frame has no timestamp, it is guessed from the last one
+static double synchronize_video(Player *player, AVFrame *pFrame,
+		double pts) {
+	AVRational frame_rate = player->vstream->avg_frame_rate;
+	double frame_delay;
 
-	if (pts != 0) {
-		video_clock = pts;
+	if (!isnan(pts)) {
+		player->video_clock = pts;
 	} else {
-		pts = video_clock;
+		pts = player->video_clock;
 	}
 
-	time_base = av_q2d(global_context.vstream->time_base);
-	frame_delay += (pFrame->repeat_pict * (time_base * 0.5));
+	/* update the video clock with the frame duration */
+	if (frame_rate.num && frame_rate.den) {
+		frame_delay = av_q2d(av_inv_q(frame_rate));
+	} else {
+		frame_delay = 0.04;
+	}
+	frame_delay += pFrame->repeat_pict * (frame_delay * 0.5);
 
-	video_clock += frame_delay;
+	player->video_clock += frame_delay;
 
 	return pts;
 }
 
-static int queue_picture(AVFrame *pFrame, double pts) {
+// the caller checked there is a free slot, only the video task writes
+static void queue_picture(Player *player, AVFrame *pFrame, double pts) {
 	VideoPicture *vp;
 
-	LOGV2("queue_picture : pFrame is %p", pFrame);
-	pthread_mutex_lock(&global_context.pictq_mutex);
-	while (global_context.pictq_size >= VIDEO_PICTURE_QUEUE_SIZE) {
-		usleep(10000);
-		LOGV2("global_context.pictq_size is %d", global_context.pictq_size);
-		pthread_cond_wait(&global_context.pictq_cond,
-				&global_context.pictq_mutex);
-	}
-	pthread_mutex_unlock(&global_context.pictq_mutex);
+	LOGV_FRAME("queue_picture : pFrame is %p", pFrame);
 
 	// windex is set to 0 initially
-	vp = &global_context.pictq[global_context.pictq_windex];
+	vp = &player->pictq[player->pictq_windex];
 	if (vp->pFrame) {
 		av_frame_unref(vp->pFrame);
 		av_frame_free(&vp->pFrame);
 	}
 	vp->pFrame = pFrame;
-	vp->width = global_context.vcodec_ctx->width;
-	vp->height = global_context.vcodec_ctx->height;
+	vp->width = player->vcodec_ctx->width;
+	vp->height = player->vcodec_ctx->height;
 
 	if (vp->pFrame) {
 		vp->pts = pts;
-		if (++global_context.pictq_windex >= VIDEO_PICTURE_QUEUE_SIZE) {
-			global_context.pictq_windex = 0;
+		if (++player->pictq_windex >= VIDEO_PICTURE_QUEUE_SIZE) {
+			player->pictq_windex = 0;
 		}
-		pthread_mutex_lock(&global_context.pictq_mutex);
-		global_context.pictq_size++;
-		pthread_mutex_unlock(&global_context.pictq_mutex);
+		pthread_mutex_lock(&player->pictq_mutex);
+		player->pictq_size++;
+		pthread_mutex_unlock(&player->pictq_mutex);
+
+		// picture_thread may wait for a new picture
+		wake_refresh(player);
 	}
+}
 
-	return 0;
+void video_display(Player *player, AVFrame* pFrame) {
+	player->video_sink->display(player, pFrame);
+}
+
+static double monotonic_time() {
+	return av_gettime_relative() / 1000000.0;
 }
 
-void video_display(AVFrame* pFrame) {
-	renderSurface(pFrame);
+// deadline is absolute, so sleeping never adds rounding to the frame pacing
+void schedule_refresh(Player *player, double deadline) {
+	player->refresh_deadline = deadline;
+}
+
+// wake picture_thread for a new picture, resume or quit
+void wake_refresh(Player *player) {
+	pthread_mutex_lock(&player->timer_mutex);
+	pthread_cond_broadcast(&player->timer_cond);
+	pthread_mutex_unlock(&player->timer_mutex);
+}
+
+// the pause lasted paused seconds, move the schedule past it
+void video_refresh_resume(Player *player, double paused) {
+	player->frame_timer += paused;
+	if (player->refresh_deadline > 0) {
+		player->refresh_deadline += paused;
+	}
+}
+
+// sleep until the scheduled refresh, or until there is a picture to show;
+// wake_refresh() cuts the sleep short for pause, stop and new pictures
+static void wait_refresh(Player *player) {
+	struct timespec ts;
+	int ret;
+
+	pthread_mutex_lock(&player->timer_mutex);
+
+	for (;;) {
+		while (!player->quit && !player->sink_request
+				&& (player->pause || player->buffering
+						|| (player->pictq_size == 0)
+						|| (player->preroll != PREROLL_STARTED))) {
+			pthread_cond_wait(&player->timer_cond,
+					&player->timer_mutex);
+		}
+
+		if (player->quit || player->sink_request) {
+			break;
+		}
+
+		// the deadline is read each time, resume moves it
+		ts.tv_sec = (time_t) player->refresh_deadline;
+		ts.tv_nsec = (long) ((player->refresh_deadline - ts.tv_sec)
+				* 1000000000.0);
+#ifdef HAVE_PTHREAD_COND_TIMEDWAIT_MONOTONIC
+		ret = pthread_cond_timedwait_monotonic_np(&player->timer_cond,
+				&player->timer_mutex, &ts);
+#else
+		ret = pthread_cond_timedwait(&player->timer_cond,
+				&player->timer_mutex, &ts);
+#endif
+
+		if (((ETIMEDOUT == ret) && !player->pause && !player->buffering)
+				|| player->sink_request) {
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&player->timer_mutex);
 }
 
-void video_refresh_callback(unsigned int timer_id, void*) {
-	video_refresh_timer();
+// every decoded picture was shown or dropped
+int video_output_finished(Player *player) {
+	return player->video_finished && (0 == player->pictq_size);
 }
 
-void schedule_refresh(int delay) {
-	timer_delay_ms = delay;
+// release the displayed or dropped picture to the decoder
+static void pictq_next(Player *player) {
+	if (++player->pictq_rindex >= VIDEO_PICTURE_QUEUE_SIZE) {
+		player->pictq_rindex = 0;
+	}
+
+	pthread_mutex_lock(&player->pictq_mutex);
+	player->pictq_size--;
+	pthread_mutex_unlock(&player->pictq_mutex);
+
+	// the video task waits for a free slot
+	task_wake(&player->video_task);
 }
 
-void video_refresh_timer() {
+void video_refresh_timer(Player *player) {
 	VideoPicture *vp;
 	double actual_delay, delay, sync_threshold, ref_clock, diff;
+	double rate = player->playback_rate;
+	int late = 0, held;
+
+	// a hold that came after the deadline keeps the picture for the resume,
+	// it is neither shown nor counted and the clocks stay where they are
+	pthread_mutex_lock(&player->pause_mutex);
+	held = player->pause || player->buffering;
+	pthread_mutex_unlock(&player->pause_mutex);
+	if (held) {
+		return;
+	}
 
-	if (global_context.pictq_size == 0) {
-		schedule_refresh(1);
+	if (player->pictq_size == 0) {
+		// show the next picture as soon as it is queued
+		schedule_refresh(player, 0);
 	} else {
-		vp = &global_context.pictq[global_context.pictq_rindex];
-
-		video_current_pts = vp->pts;
-		global_context.video_current_pts_time = av_gettime();
+		vp = &player->pictq[player->pictq_rindex];
 
-		delay = vp->pts - global_context.frame_last_pts;
+		delay = vp->pts - player->frame_last_pts;
 
 		if (delay <= 0 || delay >= 1.0) { // 非法值判断
-			delay = global_context.frame_last_delay;
+			delay = player->frame_last_delay;
 		}
 
-		global_context.frame_last_delay = delay;
-		global_context.frame_last_pts = vp->pts;
+		player->frame_last_delay = delay;
+		player->frame_last_pts = vp->pts;
 
-		ref_clock = get_master_clock();
-		diff = vp->pts - ref_clock;
+		// pts are media time, the timer runs in wall time
+		delay /= rate;
+
+		if (player->vidclk.speed != rate) {
+			set_clock_speed(&player->vidclk, rate);
+			set_clock_speed(&player->extclk, rate);
+		}
+
+		ref_clock = get_master_clock(player);
+		diff = (vp->pts - ref_clock) / rate;
+
+		metrics_record(&player->metrics, HISTOGRAM_VIDEO_QUEUE,
+				player->video_queue.nb_packets);
+		metrics_record(&player->metrics, HISTOGRAM_AUDIO_QUEUE,
+				player->audio_queue.nb_packets);
+		metrics_record(&player->metrics, HISTOGRAM_PICTURE_QUEUE,
+				player->pictq_size);
+		if (!isnan(diff)
+				&& (get_master_sync_type(player) != AV_SYNC_VIDEO_MASTER)) {
+			metrics_record(&player->metrics, HISTOGRAM_AV_DIFF,
+					(int64_t) (diff * 1000));
+		}
 
 		sync_threshold =
 				(delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
-		if (fabs(diff) < AV_NOSYNC_THRESHOLD) {
-			if (diff <= -sync_threshold) {
-				//av_log(NULL, AV_LOG_ERROR, "video_refresh_timer : skip. \n");
-				LOGV("video_refresh_timer : skip. \n");
-				delay = 0;
-			} else if (diff >= sync_threshold) {
-				//av_log(NULL, AV_LOG_ERROR, "video_refresh_timer : repeat. \n");
-				LOGV("video_refresh_timer : repeat. \n");
-				delay = 2 * delay;
+		// video itself is the reference, nothing to correct
+		if (get_master_sync_type(player) != AV_SYNC_VIDEO_MASTER) {
+			if (fabs(diff) < AV_NOSYNC_THRESHOLD) {
+				if (diff <= -sync_threshold) {
+					//av_log(NULL, AV_LOG_ERROR, "video_refresh_timer : skip. \n");
+					LOGV_FRAME("video_refresh_timer : skip. \n");
+					metrics_count(&player->metrics,
+							METRIC_FRAMES_SKIPPED);
+					delay = 0;
+					late = 1;
+				} else if (diff >= sync_threshold) {
+					//av_log(NULL, AV_LOG_ERROR, "video_refresh_timer : repeat. \n");
+					LOGV_FRAME("video_refresh_timer : repeat. \n");
+					metrics_count(&player->metrics,
+							METRIC_FRAMES_REPEATED);
+					delay = 2 * delay;
+				}
+			} else {
+				//av_log(NULL, AV_LOG_ERROR,
+				//		" video_refresh_timer : diff > 10 , diff = %f, vp->pts = %f , ref_clock = %f\n",
+				//		diff, vp->pts, ref_clock);
+				LOGV_FRAME(
+						" video_refresh_timer : diff > 10 , diff = %f, vp->pts = %f , ref_clock = %f\n",
+						diff, vp->pts, ref_clock);
+			}
+		}
+
+		// late again and again, the decoder has to do less work
+		if (late) {
+			if (++player->late_streak >= VIDEO_LATE_STREAK_NONREF) {
+				player->skip_nonref = 1;
 			}
 		} else {
-			//av_log(NULL, AV_LOG_ERROR,
-			//		" video_refresh_timer : diff > 10 , diff = %f, vp->pts = %f , ref_clock = %f\n",
-			//		diff, vp->pts, ref_clock);
-			LOGV(
-					" video_refresh_timer : diff > 10 , diff = %f, vp->pts = %f , ref_clock = %f\n",
-					diff, vp->pts, ref_clock);
+			player->late_streak = 0;
+			player->skip_nonref = 0;
+		}
+
+		// a late picture is not worth its upload when a newer one is waiting
+		if (late && (player->pictq_size > 1)) {
+			metrics_count(&player->metrics, METRIC_FRAMES_DROPPED_LATE);
+			set_clock(&player->vidclk, vp->pts,
+					player->video_queue.serial);
+			schedule_refresh(player, monotonic_time());
+			pictq_next(player);
+			return;
 		}
 
-		global_context.frame_timer += delay;
+		player->frame_timer += delay;
 
-		actual_delay = global_context.frame_timer - (av_gettime() / 1000000.0);
+		actual_delay = player->frame_timer - monotonic_time();
 		if (actual_delay < 0.010) {    //每秒100帧的刷新率不存在
 
-			actual_delay = 0.010;
+			schedule_refresh(player, monotonic_time() + 0.010);
+		} else {
+			schedule_refresh(player, player->frame_timer);
 		}
-		schedule_refresh((int) (actual_delay * 1000 + 0.5)); //add 0.5 for 进位
 		if (vp->pFrame)
-			video_display(vp->pFrame);
-
-		if (++global_context.pictq_rindex >= VIDEO_PICTURE_QUEUE_SIZE) {
-			global_context.pictq_rindex = 0;
+			video_display(player, vp->pFrame);
+		if (0 == player->metrics.counters[METRIC_FRAMES_DISPLAYED]) {
+			metrics_set(&player->metrics, METRIC_FIRST_FRAME_TIME,
+					av_gettime_relative() - player->start_us);
 		}
+		metrics_count(&player->metrics, METRIC_FRAMES_DISPLAYED);
+
+		// the video clock follows what is on screen
+		set_clock(&player->vidclk, vp->pts,
+				player->video_queue.serial);
+		sync_clock_to_slave(&player->extclk, &player->vidclk);
 
-		pthread_mutex_lock(&global_context.pictq_mutex);
-		global_context.pictq_size--;
-		pthread_cond_signal(&global_context.pictq_cond);
-		pthread_mutex_unlock(&global_context.pictq_mutex);
+		pictq_next(player);
 	}
 }
 
-void* video_thread(void *argv) {
+// the video task, decodes while there are packets and free picture slots
+int decode_video(void *opaque) {
+	Player *player = (Player*) opaque;
 	AVPacket pkt1;
 	AVPacket *packet = &pkt1;
-	int frameFinished;
+	int ret, step;
+	int64_t decode_start, ts;
 
 	double pts;
 
-	for (;;) {
+	for (step = 0; step < VIDEO_SLICE_STEPS; step++) {
 
-		if (global_context.quit) {
-			av_log(NULL, AV_LOG_ERROR, "video_thread need exit. \n");
-			break;
+		if (player->quit) {
+			av_log(NULL, AV_LOG_ERROR, "decode_video need exit. \n");
+			av_frame_free(&player->video_frame);
+			return TASK_DONE;
 		}
 
-		if (global_context.pause) {
-			continue;
+		// resumePlayer() and pictq_next() queue us again
+		if (player->pause
+				|| (player->pictq_size >= VIDEO_PICTURE_QUEUE_SIZE)) {
+			return TASK_WAIT;
 		}
 
-		if (packet_queue_get(&global_context.video_queue, packet) <= 0) {
-			// means we quit getting packets
-			continue;
+		if (NULL == player->video_frame) {
+			player->video_frame = av_frame_alloc();
+		}
+
+		// at high rates or when we keep falling behind, most frames could
+		// not be shown in time anyway
+		if ((player->playback_rate > VIDEO_SKIP_NONREF_RATE)
+				|| player->skip_nonref) {
+			player->vcodec_ctx->skip_frame = AVDISCARD_NONREF;
+		} else {
+			player->vcodec_ctx->skip_frame = AVDISCARD_DEFAULT;
 		}
 
-		AVFrame *pFrame = av_frame_alloc();
-		frameFinished = 0;
-		avcodec_decode_video2(global_context.vcodec_ctx, pFrame, &frameFinished,
-				packet);
+		// one packet may give many frames, take them all before sending more
+		TRACE_BEGIN("decode");
+		decode_start = av_gettime_relative();
+		ret = avcodec_receive_frame(player->vcodec_ctx, player->video_frame);
+		player->video_decode_time += av_gettime_relative() - decode_start;
+		TRACE_END("decode");
+		if (ret >= 0) {
+			// everything spent in the decoder since the last frame
+			metrics_count(&player->metrics, METRIC_VIDEO_FRAMES);
+			metrics_record(&player->metrics, HISTOGRAM_DECODE_TIME,
+					player->video_decode_time);
+			player->video_decode_time = 0;
+
+			// in display order, so reordered B-frames get the right pts
+			ts = av_frame_get_best_effort_timestamp(player->video_frame);
+			if (ts != AV_NOPTS_VALUE) {
+				skip_track_frame(player, ts);
+			}
+			pts = stream_timestamp_to_seconds(player, player->vstream, ts,
+					&player->video_last_ts);
 
-		/*av_log(NULL, AV_LOG_ERROR,
-		 "packet_queue_get size is %d, format is %d\n", packet->size,
-		 pFrame->format);*/
+			pts = synchronize_video(player, player->video_frame, pts);
 
-		// Did we get a video frame?
-		if (frameFinished) {
-			pts = pFrame->pkt_pts * av_q2d(global_context.vstream->time_base);
+			// the picture queue owns the frame now
+			TRACE_BEGIN("queue_picture");
+			queue_picture(player, player->video_frame, pts);
+			TRACE_END("queue_picture");
+			player->video_frame = NULL;
+			preroll_check(player);
+			continue;
+		}
 
-			pts = synchronize_video(pFrame, pts);
+		if (ret == AVERROR_EOF) {
+			av_log(NULL, AV_LOG_ERROR, "decode_video end of stream. \n");
+			player->video_finished = 1;
+			skip_track_frame(player, AV_NOPTS_VALUE);
+			preroll_check(player);
+			return TASK_DONE;
+		}
 
-			if (queue_picture(pFrame, pts) < 0) {
-				break;
-			}
+		// the demux task queues us again when it has read more
+		ret = packet_queue_get(&player->video_queue, packet, 0);
+		if (ret < 0) {
+			return TASK_DONE;
+		} else if (0 == ret) {
+			return TASK_WAIT;
+		}
+		wake_demux(player);
+
+		// an empty packet marks the end of stream, it enters draining mode
+		TRACE_BEGIN("decode");
+		decode_start = av_gettime_relative();
+		if ((NULL == packet->data) && (0 == packet->size)) {
+			ret = avcodec_send_packet(player->vcodec_ctx, NULL);
 		} else {
-			av_frame_free(&pFrame);
+			ret = avcodec_send_packet(player->vcodec_ctx, packet);
+		}
+		player->video_decode_time += av_gettime_relative() - decode_start;
+		TRACE_END("decode");
+
+		if (ret < 0) {
+			char errbuf[64];
+			av_strerror(ret, errbuf, 64);
+			av_log(NULL, AV_LOG_ERROR, "avcodec_send_packet : %s \n", errbuf);
+		} else if (packet->data) {
+			metrics_count(&player->metrics, METRIC_VIDEO_PACKETS);
+			skip_track_packet(player, packet);
 		}
 
 		av_packet_unref(packet);
-		av_init_packet(packet);
 	}
 
-	return 0;
+	return TASK_AGAIN;
+}
+
+static void run_sink_request(Player *player, int request) {
+	VideoSink *sink = player->video_sink;
+
+	if ((VIDEO_SINK_ATTACH == request) && sink->attach) {
+		if (sink->attach(player) < 0) {
+			av_log(NULL, AV_LOG_ERROR, "%s attach failure. \n", sink->name);
+		}
+	} else if ((VIDEO_SINK_DETACH == request) && sink->detach) {
+		sink->detach(player);
+	}
+}
+
+// the output window of the sink changed: the call runs on picture_thread,
+// where the sink lives, and this waits for it. When picture_thread does not
+// run the call is made here, under timer_mutex.
+void video_sink_request(Player *player, int request) {
+	pthread_mutex_lock(&player->timer_mutex);
+	if (player->picture_running) {
+		player->sink_request = request;
+		pthread_cond_broadcast(&player->timer_cond);
+		while (player->sink_request != VIDEO_SINK_NONE) {
+			pthread_cond_wait(&player->timer_cond, &player->timer_mutex);
+		}
+	} else {
+		run_sink_request(player, request);
+	}
+	pthread_mutex_unlock(&player->timer_mutex);
+}
+
+// on picture_thread, run the pending request and release its caller
+static void sink_request_done(Player *player, int exiting) {
+	int request;
+
+	pthread_mutex_lock(&player->timer_mutex);
+	request = player->sink_request;
+	pthread_mutex_unlock(&player->timer_mutex);
+
+	if (request != VIDEO_SINK_NONE) {
+		run_sink_request(player, request);
+	}
+
+	pthread_mutex_lock(&player->timer_mutex);
+	player->sink_request = VIDEO_SINK_NONE;
+	if (exiting) {
+		player->picture_running = 0;
+	}
+	pthread_cond_broadcast(&player->timer_cond);
+	pthread_mutex_unlock(&player->timer_mutex);
 }
 
 void* picture_thread(void *argv) {
-	EGLBoolean success = eglMakeCurrent(global_context.eglDisplay,
-			global_context.eglSurface, global_context.eglSurface,
-			global_context.eglContext);
-	CreateProgram();
+	Player *player = (Player*) argv;
+	VideoSink *sink = player->video_sink;
+
+	// window changes come here from now on
+	pthread_mutex_lock(&player->timer_mutex);
+	player->picture_running = 1;
+	pthread_mutex_unlock(&player->timer_mutex);
+
+	// a gl sink binds its context to this thread
+	if (sink->open(player, player->vcodec_ctx->width,
+			player->vcodec_ctx->height) < 0) {
+		av_log(NULL, AV_LOG_ERROR, "picture_thread : %s open failure. \n",
+				sink->name);
+	}
+
+	TRACE_THREAD("picture");
 
 	while (1) {
-		if (global_context.quit) {
+		wait_refresh(player);
+
+		if (player->quit) {
 			break;
 		}
 
-		if (global_context.pause) {
+		if (player->sink_request) {
+			sink_request_done(player, 0);
 			continue;
 		}
 
-		usleep(timer_delay_ms * 1000);
-
-		video_refresh_timer();
+		TRACE_BEGIN("refresh");
+		video_refresh_timer(player);
+		TRACE_END("refresh");
 
 	}
+
+	sink->close(player);
+	sink_request_done(player, 1);
 	return 0;
 }
 
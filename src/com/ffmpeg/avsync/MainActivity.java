@@ -8,6 +8,8 @@ import android.widget.RelativeLayout;
 
 public class MainActivity extends Activity {
 	// private static final String TAG = "MainActivity";
+	private static final String TEST_FILE_TFCARD = "/mnt/extSdCard/clear.ts";
+	private static final long STREAM_CACHE_BYTES = 256L * 1024 * 1024;
 	private VideoSurface mVideoSurface;
 	private RelativeLayout mRootView;
 
@@ -25,6 +27,9 @@ public class MainActivity extends Activity {
 
 		// creat surfaceview
 		mVideoSurface = new VideoSurface(this);
+		mVideoSurface.setStreamCache(getCacheDir() + "/media",
+				STREAM_CACHE_BYTES);
+		mVideoSurface.open(TEST_FILE_TFCARD);
 		mRootView.addView(mVideoSurface);
 	}
 
@@ -44,5 +49,6 @@ public class MainActivity extends Activity {
 	protected void onDestroy() {
 		super.onDestroy();
 		mVideoSurface.stopPlayer();
+		mVideoSurface.release();
 	}
 }
@@ -1,6 +1,12 @@
 package com.ffmpeg.avsync;
 
+import java.nio.ByteBuffer;
+
 import android.content.Context;
+import android.content.res.AssetFileDescriptor;
+import android.os.Handler;
+import android.os.Looper;
+import android.os.ParcelFileDescriptor;
 import android.util.Log;
 import android.view.Surface;
 import android.view.SurfaceHolder;
@@ -9,15 +15,44 @@ import android.view.SurfaceView;
 public class VideoSurface extends SurfaceView implements SurfaceHolder.Callback {
 	private static final String TAG = "VideoSurface";
 
+	// master clock of the a/v sync, see setSyncType()
+	public static final int SYNC_AUDIO_MASTER = 0;
+	public static final int SYNC_VIDEO_MASTER = 1;
+	public static final int SYNC_EXTERNAL_MASTER = 2;
+
+	// scheduling of the decoding work, see setPriority()
+	public static final int PRIORITY_FOREGROUND = 0;
+	public static final int PRIORITY_PREVIEW = 1;
+
+	// native log categories, see setLogLevel()
+	public static final int LOG_CATEGORY_PLAYER = 0;
+	public static final int LOG_CATEGORY_VIDEO = 1;
+	public static final int LOG_CATEGORY_AUDIO = 2;
+
+	// playback held and resumed to refill the queues, on the main thread;
+	// inputPercent is the input throughput in % of the media bitrate, -1
+	// when not known
+	public interface OnBufferingListener {
+		void onBuffering(VideoSurface view, boolean buffering, int bufferedMs,
+				int inputPercent);
+	}
+
 	static {
 		System.loadLibrary("ffmpeg");
 		System.loadLibrary("avsync");
 	}
 
+	// the native player of this view, every view plays on its own
+	private long mNativePlayer;
+
+	private final Handler mHandler = new Handler(Looper.getMainLooper());
+	private volatile OnBufferingListener mBufferingListener;
+
 	public VideoSurface(Context context) {
 		super(context);
 		Log.v(TAG, "VideoSurface");
 
+		mNativePlayer = nativeCreatePlayer();
 		getHolder().addCallback(this);
 	}
 
@@ -39,26 +74,202 @@ public class VideoSurface extends SurfaceView implements SurfaceHolder.Callback
 	@Override
 	public void surfaceDestroyed(SurfaceHolder holder) {
 		Log.v(TAG, "surfaceDestroyed");
-		//nativeStopPlayer();
+		// playback holds until surfaceCreated() brings a new one
+		setSurface(null);
+	}
+
+	// attaches the surface, playing starts once a source is opened too. A
+	// playing player takes a new surface; null holds it and lets the old go.
+	public int setSurface(Surface view) {
+		if (mNativePlayer == 0) {
+			return -1;
+		}
+		return nativeSetSurface(mNativePlayer, view);
+	}
+
+	// a file path or a url, one source per player
+	public int open(String path) {
+		return nativeOpenPath(mNativePlayer, path);
+	}
+
+	// length bytes from offset, negative to the end; the descriptor is
+	// duplicated, the caller may close it
+	public int open(ParcelFileDescriptor fd, long offset, long length) {
+		return nativeOpenFd(mNativePlayer, fd.getFd(), offset, length);
+	}
+
+	// an uncompressed asset, or a file of a content provider
+	public int open(AssetFileDescriptor afd) {
+		return open(afd.getParcelFileDescriptor(), afd.getStartOffset(),
+				afd.getDeclaredLength());
+	}
+
+	// media in a direct buffer, which is read in place until release()
+	public int open(ByteBuffer buffer) {
+		if (!buffer.isDirect()) {
+			return -1;
+		}
+		return nativeOpenBuffer(mNativePlayer, buffer);
 	}
 
 	public int pausePlayer() {
-		return nativePausePlayer();
+		return nativePausePlayer(mNativePlayer);
 	}
 
 	public int resumePlayer() {
-		return nativeResumePlayer();
+		return nativeResumePlayer(mNativePlayer);
 	}
 
+	// the surface may go after release()
 	public int stopPlayer() {
-		return nativeStopPlayer();
+		if (mNativePlayer == 0) {
+			return 0;
+		}
+		return nativeStopPlayer(mNativePlayer);
+	}
+
+	// frees the native player, the view can not play afterwards
+	public void release() {
+		if (mNativePlayer != 0) {
+			nativeDestroyPlayer(mNativePlayer);
+			mNativePlayer = 0;
+		}
+	}
+
+	// takes effect when the surface is set and the media opened
+	public int setSyncType(int type) {
+		return nativeSetSyncType(mNativePlayer, type);
+	}
+
+	// before playing starts, 0 keeps the default; fastStart skips probing when
+	// the container headers describe every stream, as mp4 ones do
+	public int setProbeOptions(long probeSize, long analyzeDurationUs,
+			boolean fastStart) {
+		return nativeSetProbeOptions(mNativePlayer, probeSize,
+				analyzeDurationUs, fastStart);
+	}
+
+	// before playing starts, ms of audio buffered before playback starts
+	public int setPrerollDuration(int audioMs) {
+		return nativeSetPrerollDuration(mNativePlayer, audioMs);
+	}
+
+	// before playing starts, bytes of a local file read ahead of the demuxer;
+	// seconds > 0 reads that much of the media instead, up to bytes
+	public int setReadAhead(long bytes, float seconds) {
+		return nativeSetReadAhead(mNativePlayer, bytes, seconds);
+	}
+
+	// before playing starts, playback is held when less than lowMs of media
+	// is read ahead, until highMs is, more for inputs slower than the media
+	public int setBufferingWatermarks(int lowMs, int highMs) {
+		return nativeSetBufferingWatermarks(mNativePlayer, lowMs, highMs);
+	}
+
+	public void setOnBufferingListener(OnBufferingListener listener) {
+		mBufferingListener = listener;
 	}
 
-	public native int setSurface(Surface view);
+	// called by the native player from its own threads
+	private void onNativeBuffering(final boolean buffering,
+			final int bufferedMs, final int inputPercent) {
+		mHandler.post(new Runnable() {
+			@Override
+			public void run() {
+				OnBufferingListener listener = mBufferingListener;
+				if (listener != null) {
+					listener.onBuffering(VideoSurface.this, buffering,
+							bufferedMs, inputPercent);
+				}
+			}
+		});
+	}
+
+	// previews only decode when no foreground player has work
+	public void setPriority(int priority) {
+		nativeSetPriority(mNativePlayer, priority);
+	}
+
+	// { late pictures dropped before render, frames skipped by the decoder }
+	public long[] getFrameDrops() {
+		return nativeGetFrameDrops(mNativePlayer);
+	}
+
+	// counters: displayed, skipped, repeated, dropped late, video packets,
+	// video frames, audio underruns, open time us, first frame time us,
+	// cache hits, cache misses, rebuffers, rebuffer time us, dropped early;
+	// then for each histogram (a/v diff ms, video queue, audio queue,
+	// picture queue, decode time us): bucket count n, n - 1 upper bounds,
+	// n counts and the sum of the values
+	public long[] getMetrics() {
+		return nativeGetMetrics(mNativePlayer);
+	}
+
+	// chrome trace event json of every player, null unless the native side was built
+	// with AVSYNC_TRACE
+	public String dumpTrace() {
+		return nativeDumpTrace();
+	}
+
+	// for every player, http media and HLS segments are kept in dir up to
+	// maxBytes and segments are fetched ahead into it; null turns it off
+	public int setStreamCache(String dir, long maxBytes) {
+		return nativeSetStreamCache(dir, maxBytes);
+	}
+
+	// level is a Log priority, Log.VERBOSE to Log.ERROR, for every player;
+	// levels compiled out of the native build can not be turned back on
+	public int setLogLevel(int category, int level) {
+		return nativeSetLogLevel(category, level);
+	}
+
+	// rate is 0.5 to 4.0, audio keeps its pitch
+	public int setPlaybackRate(float rate) {
+		return nativeSetPlaybackRate(mNativePlayer, rate);
+	}
+
+	public native long nativeCreatePlayer();
+
+	public native void nativeDestroyPlayer(long player);
+
+	public native int nativeSetSurface(long player, Surface view);
+
+	public native int nativeOpenPath(long player, String path);
+
+	public native int nativeOpenFd(long player, int fd, long offset,
+			long length);
+
+	public native int nativeOpenBuffer(long player, ByteBuffer buffer);
+
+	public native int nativePausePlayer(long player);
+
+	public native int nativeResumePlayer(long player);
+
+	public native int nativeStopPlayer(long player);
+
+	public native int nativeSetPlaybackRate(long player, float rate);
+
+	public native int nativeSetSyncType(long player, int type);
+
+	public native int nativeSetProbeOptions(long player, long probeSize,
+			long analyzeDurationUs, boolean fastStart);
+
+	public native int nativeSetPrerollDuration(long player, int audioMs);
+
+	public native int nativeSetReadAhead(long player, long bytes, float seconds);
+
+	public native int nativeSetBufferingWatermarks(long player, int lowMs,
+			int highMs);
+
+	public native void nativeSetPriority(long player, int priority);
+
+	public native long[] nativeGetFrameDrops(long player);
+
+	public native long[] nativeGetMetrics(long player);
 
-	public native int nativePausePlayer();
+	public native String nativeDumpTrace();
 
-	public native int nativeResumePlayer();
+	public native int nativeSetStreamCache(String dir, long maxBytes);
 
-	public native int nativeStopPlayer();
+	public native int nativeSetLogLevel(int category, int level);
 }